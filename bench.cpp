@@ -0,0 +1,547 @@
+/* Benchmarks for the engine and the drawing code, written as a baseline file that can be diffed between builds.
+
+   Usage: tetris_bench [options]
+     --out FILE         write the results to FILE as well as printing them
+     --compare FILE     compare the results with a baseline written by --out, and exit with 1 on a regression
+     --compare-timings FILE  compare only the timings with FILE, a baseline recorded on this machine with --out.
+                        Skipped, with a note, if FILE doesn't exist.
+     --counts           only run the benchmarks that count, which take no time and give the same results anywhere
+     --threshold F      how much slower a timing may be than the baseline before it counts as a regression
+                        (default: 0.25, 25%)
+     --filter TEXT      only run the benchmarks whose names contain TEXT
+     --min-time MS      shortest a timed run may take, the iteration count doubles until it's reached (default: 50)
+     --repeats N        timed runs of each benchmark, the fastest is kept (default: 5)
+     --save-fixtures DIR  write the replays the board fixtures are played from to DIR
+
+   Benchmarks:
+     check.move, check.rotate, check.can_fall   collision queries on a midgame board with the shape resting on the
+                                                stack, alternating directions
+     add_shape.clear_N                          locking a vertical line that completes N rows, for N from 0 to 4
+     generate_random_shape                      drawing a piece from the game's random generator
+     headless_game                              a whole game with random actions, from a fixed set of seeds
+     draw.<fixture>.<count>                     what draw_scene, and so display(), asks of the canvas for each
+                                                board fixture: cubes, lines, glyphs, draw calls, and colour,
+                                                lighting and matrix changes
+     draw.<fixture>.software                    drawing the fixture with the software renderer at 256x256
+
+   The board fixtures are played from fixed seeds with random actions, so they're the same on every machine:
+     empty      a new game
+     midgame    after 12 shapes have locked
+     tall       once the stack reaches row 14
+     game_over  the end of the game, which also draws the game over text
+
+   Each result is a line of "name<TAB>value<TAB>unit". Timings are in nanoseconds per operation and are compared
+   against the threshold. Counts come out the same on every machine, so any change in a count is reported. Lines
+   starting with # are comments. Timings only mean something against a baseline from the same machine, so the
+   committed bench_baseline.tsv holds only counts (written with --counts), and timings are compared with a local
+   baseline through --compare-timings.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include <unistd.h>
+
+#include "engine.h"
+#include "render.h"
+#include "softraster.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+struct BenchOptions {
+	std::string out;
+	std::string compare;
+	std::string compare_timings;
+	bool counts_only = false;
+	double threshold = 0.25;
+	std::string filter;
+	double min_time_ms = 50;
+	int repeats = 5;
+	std::string fixtures_dir;
+};
+
+struct BenchResult {
+	std::string name;
+	double value;
+	std::string unit;		// "ns" for nanoseconds per operation, "count" for exact counts
+};
+
+template <typename T>
+static inline void keep(const T& value) {
+	/* Make the compiler assume value is read and anything reachable from it may have changed, so the work that
+	   produced it can't be dropped or hoisted out of a loop
+	*/
+	asm volatile("" : : "r"(&value) : "memory");
+}
+
+static double nanosecondsSince(bench_clock::time_point start) {
+	return std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+}
+
+template <typename Run>
+static double timePerOperation(const BenchOptions& options, Run run) {
+	/* run(iterations) carries out the operation that many times and returns the nanoseconds the timed part took.
+	   The iteration count is doubled until a run takes at least min_time, then the fastest of the repeats is kept.
+	*/
+	uint64_t iterations = 1;
+	while ((run(iterations) < options.min_time_ms * 1e6) and (iterations < (1ull << 40))) {
+		iterations *= 2;
+	}
+	double best = 0;
+	for (int i = 0; i < options.repeats; i++) {
+		double per_operation = run(iterations) / iterations;
+		if ((i == 0) or (per_operation < best)) {
+			best = per_operation;
+		}
+	}
+	return best;
+}
+
+template <typename Operation>
+static double timeLoop(uint64_t iterations, Operation operation) {
+	bench_clock::time_point start = bench_clock::now();
+	for (uint64_t i = 0; i < iterations; i++) {
+		operation(i);
+	}
+	return nanosecondsSince(start);
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+static int stackHeight(const Game& game) {
+	/* Rows up to and including the highest filled tile */
+	for (int y = BOARD_HEIGHT - 1; y >= 0; y--) {
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			if (game.getTile(x, y) != TileState::EMPTY) {
+				return y + 1;
+			}
+		}
+	}
+	return 0;
+}
+
+static Action randomAction(PieceRandom& random, bool& act) {
+	/* The random player: acts on one tick in four, and slams one time in sixteen so games don't take too long */
+	const Action moves[4] = { Action::LEFT, Action::RIGHT, Action::ROTATE_CLOCKWISE, Action::ROTATE_COUNTERCLOCKWISE };
+	act = (random.nextBelow(4) == 0);
+	int roll = random.nextBelow(16);
+	return (roll == 0) ? Action::SLAM : moves[roll % 4];
+}
+
+template <typename Stop>
+static Game playFixture(uint64_t seed, Replay& replay, Stop stop) {
+	/* Play a game with random actions from seed until stop(game) or the game ends, recording it in replay */
+	Game game(seed);
+	PieceRandom random(seed ^ 0x5DEECE66DULL);
+	replay = Replay();
+	replay.seed = seed;
+	while (!game.isGameOver() and !stop(game)) {
+		bool act;
+		Action action = randomAction(random, act);
+		if (act) {
+			replay.events.push_back(ReplayEvent{ game.getTicks(), action });
+			game.apply(action);
+		}
+		game.tick();
+	}
+	replay.end_tick = game.getTicks();
+	return game;
+}
+
+struct Fixture {
+	const char* name;
+	Game game;
+	Replay replay;
+};
+
+static std::vector<Fixture> boardFixtures() {
+	std::vector<Fixture> fixtures;
+	Replay replay;
+	Game game = playFixture(11, replay, [](const Game&) { return true; });
+	fixtures.push_back(Fixture{ "empty", game, replay });
+	game = playFixture(12, replay, [](const Game& game) { return game.getPiecesPlaced() >= 12; });
+	fixtures.push_back(Fixture{ "midgame", game, replay });
+	game = playFixture(13, replay, [](const Game& game) { return stackHeight(game) >= 14; });
+	fixtures.push_back(Fixture{ "tall", game, replay });
+	game = playFixture(14, replay, [](const Game&) { return false; });
+	fixtures.push_back(Fixture{ "game_over", game, replay });
+	return fixtures;
+}
+
+static Game lineClearing(int rows) {
+	/* A game whose falling shape is a vertical line resting in the gap in column 4 of the bottom four rows. The first
+	   `rows` of them are full apart from the gap, the rest also have a gap in column 0, so locking the line clears
+	   exactly `rows` rows.
+	*/
+	uint64_t seed = 1;
+	while (Game(seed).getCurrentShape().getPieceType() != PieceType::LINE) {
+		seed++;
+	}
+	Game game(seed);
+	for (int y = 0; y < 4; y++) {
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			if ((x != 4) and ((x != 0) or (y < rows))) {
+				game.setTile(x, y, static_cast<TileState>(1 + (x + y) % 7));
+			}
+		}
+	}
+	while (game.checkShapeCanFall()) {
+		game.doGravity();
+	}
+	return game;
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+class CountingCanvas : public Canvas {
+	/* Canvas that draws nothing and counts what it's asked to do */
+public:
+	uint64_t cubes = 0;
+	uint64_t lines = 0;
+	uint64_t glyphs = 0;
+	uint64_t colour_changes = 0;
+	uint64_t lighting_changes = 0;
+	uint64_t matrix_operations = 0;
+
+	void lookAt(float, float, float, float, float, float, float, float, float) override {
+		matrix_operations++;
+	}
+
+	void pushMatrix() override {
+		matrix_operations++;
+	}
+
+	void popMatrix() override {
+		matrix_operations++;
+	}
+
+	void translate(float, float, float) override {
+		matrix_operations++;
+	}
+
+	void scale(float, float, float) override {
+		matrix_operations++;
+	}
+
+	void setColour(Colour) override {
+		colour_changes++;
+	}
+
+	void setLighting(bool) override {
+		lighting_changes++;
+	}
+
+	void solidCube(float) override {
+		cubes++;
+	}
+
+	void lineLoop(const float[][3], int) override {
+		lines++;
+	}
+
+	void strokeCharacter(char) override {
+		glyphs++;
+	}
+};
+
+class BenchRunner {
+private:
+	const BenchOptions& options;
+	std::vector<BenchResult> results;
+
+	bool selected(const std::string& name) const {
+		return options.filter.empty() or (name.find(options.filter) != std::string::npos);
+	}
+
+	void add(const std::string& name, double value, const char* unit) {
+		results.push_back(BenchResult{ name, value, unit });
+		printf("%-32s %14.2f %s\n", name.c_str(), value, unit);
+		fflush(stdout);
+	}
+
+public:
+	explicit BenchRunner(const BenchOptions& options) : options(options) {}
+
+	const std::vector<BenchResult>& getResults() const {
+		return results;
+	}
+
+	template <typename Run>
+	void time(const std::string& name, Run run) {
+		if (selected(name) and !options.counts_only) {
+			add(name, timePerOperation(options, run), "ns");
+		}
+	}
+
+	void count(const std::string& name, uint64_t value) {
+		if (selected(name)) {
+			add(name, (double)value, "count");
+		}
+	}
+};
+
+static void benchChecks(BenchRunner& runner, const Game& midgame) {
+	Game game = midgame;
+	while (game.checkShapeCanFall()) {
+		game.doGravity();
+	}
+	runner.time("check.move", [&](uint64_t iterations) {
+		return timeLoop(iterations, [&](uint64_t i) {
+			bool fits = game.checkShapeMove((i & 1) ? LEFT : RIGHT);
+			keep(fits);
+		});
+	});
+	runner.time("check.rotate", [&](uint64_t iterations) {
+		return timeLoop(iterations, [&](uint64_t i) {
+			bool fits = game.checkShapeRotate((i & 1) ? COUNTERCLOCKWISE : CLOCKWISE);
+			keep(fits);
+		});
+	});
+	runner.time("check.can_fall", [&](uint64_t iterations) {
+		return timeLoop(iterations, [&](uint64_t) {
+			bool fits = game.checkShapeCanFall();
+			keep(fits);
+		});
+	});
+}
+
+static void benchAddShape(BenchRunner& runner) {
+	const size_t BATCH = 64;
+	for (int rows = 0; rows <= 4; rows++) {
+		Game fixture = lineClearing(rows);
+		Game check = fixture;
+		check.addShapeToBoard();
+		if (check.getRowsCleared() != rows) {
+			fprintf(stderr, "add_shape.clear_%d fixture cleared %d rows\n", rows, check.getRowsCleared());
+			exit(1);
+		}
+		// Locking a shape changes the game, so each one works on a fresh copy made outside the timed part
+		std::vector<Game> batch(BATCH, fixture);
+		runner.time("add_shape.clear_" + std::to_string(rows), [&](uint64_t iterations) {
+			double total = 0;
+			for (uint64_t done = 0; done < iterations; done += BATCH) {
+				size_t count = std::min<uint64_t>(BATCH, iterations - done);
+				for (size_t i = 0; i < count; i++) {
+					batch[i] = fixture;
+				}
+				total += timeLoop(count, [&](uint64_t i) {
+					batch[i].addShapeToBoard();
+					keep(batch[i]);
+				});
+			}
+			return total;
+		});
+	}
+}
+
+static void benchGames(BenchRunner& runner) {
+	runner.time("generate_random_shape", [&](uint64_t iterations) {
+		PieceRandom random(1);
+		return timeLoop(iterations, [&](uint64_t) {
+			Shape shape = generateRandomShape(random);
+			keep(shape);
+		});
+	});
+
+	const uint64_t GAMES = 16;
+	uint64_t ticks = 0;
+	for (uint64_t seed = 1; seed <= GAMES; seed++) {
+		Replay replay;
+		ticks += playFixture(seed, replay, [](const Game&) { return false; }).getTicks();
+	}
+	runner.time("headless_game", [&](uint64_t iterations) {
+		return timeLoop(iterations, [&](uint64_t i) {
+			Replay replay;
+			Game game = playFixture(1 + i % GAMES, replay, [](const Game&) { return false; });
+			keep(game);
+		});
+	});
+	runner.count("headless_game.ticks", ticks / GAMES);
+}
+
+static void benchDrawing(BenchRunner& runner, const std::vector<Fixture>& fixtures) {
+	for (const Fixture& fixture : fixtures) {
+		std::string prefix = std::string("draw.") + fixture.name + ".";
+		CountingCanvas counts;
+		draw_scene(counts, fixture.game, false);
+		runner.count(prefix + "cubes", counts.cubes);
+		runner.count(prefix + "lines", counts.lines);
+		runner.count(prefix + "glyphs", counts.glyphs);
+		runner.count(prefix + "draw_calls", counts.cubes + counts.lines + counts.glyphs);
+		runner.count(prefix + "colour_changes", counts.colour_changes);
+		runner.count(prefix + "lighting_changes", counts.lighting_changes);
+		runner.count(prefix + "matrix_operations", counts.matrix_operations);
+
+		SoftwareCanvas canvas(256, 256);
+		runner.time(prefix + "software", [&](uint64_t iterations) {
+			return timeLoop(iterations, [&](uint64_t) {
+				canvas.clear(BACKGROUND_COLOUR);
+				draw_scene(canvas, fixture.game, false);
+				keep(canvas);
+			});
+		});
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+static bool writeResults(const char* path, const std::vector<BenchResult>& results) {
+	FILE* file = fopen(path, "w");
+	if (file == nullptr) {
+		return false;
+	}
+	fprintf(file, "# tetris_bench results: name, value, unit (ns per operation or an exact count)\n");
+	for (const BenchResult& result : results) {
+		fprintf(file, "%s\t%.2f\t%s\n", result.name.c_str(), result.value, result.unit.c_str());
+	}
+	return fclose(file) == 0;
+}
+
+static bool readResults(const char* path, std::map<std::string, BenchResult>& results) {
+	FILE* file = fopen(path, "r");
+	if (file == nullptr) {
+		return false;
+	}
+	char line[512];
+	while (fgets(line, sizeof(line), file) != nullptr) {
+		if ((line[0] == '#') or (line[0] == '\n')) {
+			continue;
+		}
+		char name[256];
+		char unit[32];
+		double value;
+		if (sscanf(line, "%255[^\t]\t%lf\t%31s", name, &value, unit) == 3) {
+			results[name] = BenchResult{ name, value, unit };
+		}
+	}
+	fclose(file);
+	return true;
+}
+
+static int compareResults(const char* path, const std::vector<BenchResult>& results, double threshold, bool timings_only) {
+	/* Report each result that differs from the baseline, or each timing if timings_only. Returns the number of
+	   regressions.
+	*/
+	std::map<std::string, BenchResult> baseline;
+	if (!readResults(path, baseline)) {
+		perror(path);
+		return -1;
+	}
+	int regressions = 0;
+	printf("\nCompared %s with %s:\n", timings_only ? "timings" : "results", path);
+	for (const BenchResult& result : results) {
+		if (timings_only and (result.unit != "ns")) {
+			continue;
+		}
+		auto found = baseline.find(result.name);
+		if (found == baseline.end()) {
+			// Baselines without timings are the usual case, so only a new count is worth noting
+			if (result.unit == "count") {
+				printf("  %-32s new\n", result.name.c_str());
+			}
+			continue;
+		}
+		double before = found->second.value;
+		if (result.unit == "count") {
+			if (result.value != before) {
+				printf("  %-32s REGRESSION %.0f -> %.0f\n", result.name.c_str(), before, result.value);
+				regressions++;
+			}
+			continue;
+		}
+		double change = (before > 0) ? (result.value - before) / before : 0;
+		if (change > threshold) {
+			printf("  %-32s REGRESSION %.2f -> %.2f ns (%+.0f%%)\n", result.name.c_str(), before, result.value, change * 100);
+			regressions++;
+		}
+		else if (change < -threshold) {
+			printf("  %-32s faster %.2f -> %.2f ns (%+.0f%%)\n", result.name.c_str(), before, result.value, change * 100);
+		}
+	}
+	printf("%d regression%s\n", regressions, (regressions == 1) ? "" : "s");
+	return regressions;
+}
+
+int main(int argc, char* argv[]) {
+	BenchOptions options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--out") and has_value) {
+			options.out = argv[++i];
+		}
+		else if ((arg == "--compare") and has_value) {
+			options.compare = argv[++i];
+		}
+		else if ((arg == "--compare-timings") and has_value) {
+			options.compare_timings = argv[++i];
+		}
+		else if (arg == "--counts") {
+			options.counts_only = true;
+		}
+		else if ((arg == "--threshold") and has_value) {
+			options.threshold = atof(argv[++i]);
+		}
+		else if ((arg == "--filter") and has_value) {
+			options.filter = argv[++i];
+		}
+		else if ((arg == "--min-time") and has_value) {
+			options.min_time_ms = std::max(1.0, atof(argv[++i]));
+		}
+		else if ((arg == "--repeats") and has_value) {
+			options.repeats = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--save-fixtures") and has_value) {
+			options.fixtures_dir = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Usage: %s [--out FILE] [--compare FILE] [--compare-timings FILE] [--threshold F] [--counts] [--filter TEXT]\n"
+				"       [--min-time MS] [--repeats N] [--save-fixtures DIR]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::vector<Fixture> fixtures = boardFixtures();
+	if (!options.fixtures_dir.empty()) {
+		for (const Fixture& fixture : fixtures) {
+			std::string path = options.fixtures_dir + "/" + fixture.name + ".replay";
+			if (!saveReplay(fixture.replay, path.c_str())) {
+				perror(path.c_str());
+				return 1;
+			}
+		}
+	}
+
+	BenchRunner runner(options);
+	benchChecks(runner, fixtures[1].game);
+	benchAddShape(runner);
+	benchGames(runner);
+	benchDrawing(runner, fixtures);
+
+	if (!options.out.empty() and !writeResults(options.out.c_str(), runner.getResults())) {
+		perror(options.out.c_str());
+		return 1;
+	}
+	int regressions = 0;
+	if (!options.compare.empty()) {
+		regressions += std::abs(compareResults(options.compare.c_str(), runner.getResults(), options.threshold, false));
+	}
+	if (!options.compare_timings.empty() and !options.counts_only) {
+		if (access(options.compare_timings.c_str(), F_OK) == 0) {
+			regressions += std::abs(compareResults(options.compare_timings.c_str(), runner.getResults(), options.threshold, true));
+		}
+		else {
+			printf("\nNo timings recorded on this machine at %s, so timings weren't compared. Record them with --out %s\n",
+				options.compare_timings.c_str(), options.compare_timings.c_str());
+		}
+	}
+	return (regressions == 0) ? 0 : 1;
+}
@@ -0,0 +1,154 @@
+#include "engine.h"
+
+#include <cstdio>
+#include <cstring>
+
+static void fillCollisionEntries(CollisionTable& table, Shape shape) {
+	/* Fill in the entries of the given shape for each of its rotations and every x offset */
+	int piece = static_cast<int>(shape.getPieceType());
+	const std::vector<std::array<relativecoords, 4>>& rotations = shape.getRotations();
+
+	int num_rotations = (int)rotations.size();
+	for (int rotation = 0; rotation < num_rotations; rotation++) {
+		for (int turn = COUNTERCLOCKWISE; turn <= CLOCKWISE; turn++) {
+			table.rotation_after[piece][rotation][turn + 1] = (uint8_t)((rotation + turn + num_rotations) % num_rotations);
+		}
+
+		int base_row = rotations[rotation][0].rely;
+		for (auto tile : rotations[rotation]) {
+			base_row = std::min(base_row, tile.rely);
+		}
+
+		for (int i = 0; i < COLLISION_X_RANGE; i++) {
+			int x = COLLISION_MIN_X + i;
+			CollisionEntry entry{ {0, 0, 0, 0}, base_row, true };
+			for (auto tile : rotations[rotation]) {
+				int column = x + tile.relx;
+				if ((column < 0) or (column >= BOARD_WIDTH)) {
+					entry.in_bounds = false;
+				}
+				else {
+					entry.rows[tile.rely - base_row] |= 1 << column;
+				}
+			}
+			table.entries[piece][rotation][i] = entry;
+		}
+	}
+}
+
+const CollisionTable& collisionTable() {
+	static const CollisionTable table = [] {
+		CollisionTable built{};
+		fillCollisionEntries(built, Line());
+		fillCollisionEntries(built, LShape());
+		fillCollisionEntries(built, TShape());
+		fillCollisionEntries(built, SShape());
+		fillCollisionEntries(built, ZShape());
+		fillCollisionEntries(built, JShape());
+		fillCollisionEntries(built, Square());
+		return built;
+	}();
+	return table;
+}
+
+Shape makeShape(PieceType piece) {
+	/* Returns a new shape of the given type */
+	switch (piece) {
+	case PieceType::LINE: return Line();
+	case PieceType::LSHAPE: return LShape();
+	case PieceType::TSHAPE: return TShape();
+	case PieceType::SSHAPE: return SShape();
+	case PieceType::ZSHAPE: return ZShape();
+	case PieceType::JSHAPE: return JShape();
+	case PieceType::SQUARE: return Square();
+	}
+	return Square();
+}
+
+Shape generateRandomShape(PieceRandom& random) {
+	/* Returns a random shape from the seven tetris pieces, each equally likely */
+	return makeShape(static_cast<PieceType>(random.nextBelow(NUM_PIECE_TYPES)));
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+/* Replay files are little-endian:
+     "TRPL", uint32 version, uint64 seed, uint32 end tick, uint32 event count,
+     then per event a uint32 tick followed by a uint8 action.
+*/
+
+const char REPLAY_MAGIC[4] = { 'T', 'R', 'P', 'L' };
+const uint32_t REPLAY_VERSION = 1;
+
+static void writeLittleEndian(FILE* file, uint64_t value, int bytes) {
+	for (int i = 0; i < bytes; i++) {
+		fputc((int)((value >> (8 * i)) & 0xFF), file);
+	}
+}
+
+static bool readLittleEndian(FILE* file, uint64_t& value, int bytes) {
+	value = 0;
+	for (int i = 0; i < bytes; i++) {
+		int c = fgetc(file);
+		if (c == EOF) {
+			return false;
+		}
+		value |= (uint64_t)c << (8 * i);
+	}
+	return true;
+}
+
+bool writeReplay(const Replay& replay, FILE* file) {
+	fwrite(REPLAY_MAGIC, 1, sizeof(REPLAY_MAGIC), file);
+	writeLittleEndian(file, REPLAY_VERSION, 4);
+	writeLittleEndian(file, replay.seed, 8);
+	writeLittleEndian(file, replay.end_tick, 4);
+	writeLittleEndian(file, replay.events.size(), 4);
+	for (const ReplayEvent& event : replay.events) {
+		writeLittleEndian(file, event.tick, 4);
+		writeLittleEndian(file, static_cast<uint8_t>(event.action), 1);
+	}
+	return ferror(file) == 0;
+}
+
+bool saveReplay(const Replay& replay, const char* path) {
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	bool written = writeReplay(replay, file);
+	return (fclose(file) == 0) and written;
+}
+
+bool readReplay(Replay& replay, FILE* file) {
+	char magic[4];
+	uint64_t version = 0, seed = 0, end_tick = 0, num_events = 0;
+	bool ok = (fread(magic, 1, sizeof(magic), file) == sizeof(magic))
+		and (memcmp(magic, REPLAY_MAGIC, sizeof(magic)) == 0)
+		and readLittleEndian(file, version, 4) and (version == REPLAY_VERSION)
+		and readLittleEndian(file, seed, 8)
+		and readLittleEndian(file, end_tick, 4)
+		and readLittleEndian(file, num_events, 4);
+
+	replay.seed = seed;
+	replay.end_tick = (uint32_t)end_tick;
+	replay.events.clear();
+	for (uint64_t i = 0; ok and (i < num_events); i++) {
+		uint64_t tick, action;
+		ok = readLittleEndian(file, tick, 4) and readLittleEndian(file, action, 1) and (action < NUM_ACTIONS);
+		if (ok) {
+			replay.events.push_back(ReplayEvent{ (uint32_t)tick, static_cast<Action>(action) });
+		}
+	}
+	return ok;
+}
+
+bool loadReplay(Replay& replay, const char* path) {
+	FILE* file = fopen(path, "rb");
+	if (file == nullptr) {
+		return false;
+	}
+	bool ok = readReplay(replay, file);
+	fclose(file);
+	return ok;
+}
@@ -0,0 +1,867 @@
+#pragma once
+
+/* The game engine: pieces, board, collision and scoring rules.
+
+   Nothing in here depends on GLUT or OpenGL, so the engine can run headless (replays, tools) as well as behind
+   the window in Tetris.cpp. All state belongs to a Game, and pieces are drawn from the game's own seeded random
+   generator, so a seed plus the actions taken at each tick reproduces a game exactly.
+*/
+
+#include <algorithm>
+#include <array>
+#include <cstdio>
+#include <vector>
+#include <stdint.h>
+
+#include "profiler.h"
+
+// Define some constants for clarity
+const int LEFT = -1;
+const int RIGHT = 1;
+
+const int CLOCKWISE = 1;
+const int COUNTERCLOCKWISE = -1;
+
+// Enum to store colour of tiles in game grid. GARBAGE tiles are pushed in from below in versus games (versus.h).
+enum class TileState { EMPTY, RED, GREEN, BLUE, PURPLE, CYAN, YELLOW, PINK, GARBAGE };
+const int NUM_TILE_STATES = 9;
+
+// Enum to identify which of the seven pieces a shape is
+enum class PieceType { LINE, LSHAPE, TSHAPE, SSHAPE, ZSHAPE, JSHAPE, SQUARE };
+const int NUM_PIECE_TYPES = 7;
+
+// Dimensions of the playable area of the board
+const int BOARD_WIDTH = 10;
+const int BOARD_HEIGHT = 20;
+
+// Rows allocated for a board: the playable area plus room for a piece that locks above the top
+const int BOARD_ROWS = 25;
+
+// Delay, in ticks, between gravity steps at the start of a game
+const int STARTING_GRAVITY = 20;
+
+/* These structs are conceptually different despite being structurally identical and so are separated for clarity */
+
+struct absolutecoords {
+	int x;
+	int y;
+};
+
+struct relativecoords {
+	int relx;
+	int rely;
+};
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+class PieceRandom {
+	/* Small seeded random number generator (splitmix64) used to pick pieces */
+private:
+	uint64_t state;
+
+public:
+	explicit PieceRandom(uint64_t seed = 0) : state(seed) {}
+
+	uint64_t next() {
+		uint64_t z = (state += 0x9E3779B97F4A7C15ull);
+		z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+		z = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+		return z ^ (z >> 31);
+	}
+
+	int nextBelow(int n) {
+		/* Returns a value in [0, n) */
+		return (int)(((next() >> 32) * (uint64_t)n) >> 32);
+	}
+
+	uint64_t getState() const {
+		return state;
+	}
+};
+
+class Shape {
+	/* Collection of attributes and methods for controlling the currently falling shape */
+protected:
+	// Starting position
+	absolutecoords grid_position{ 3,20 };
+
+	TileState colour = TileState::EMPTY;
+	PieceType piece = PieceType::SQUARE;
+
+	// Adjust where the shape appears as a lookahead
+	float look_ahead_y_adjust = 0;
+	float look_ahead_x_adjust = 0;
+
+	//Store the possible rotations of the shape and the current one
+	std::vector<std::array<relativecoords, 4>> shaperotations;
+	int currentrotation = 0;
+
+public:
+	void descend() {
+		grid_position.y -= 1;
+	}
+
+	void ascend() {
+		grid_position.y += 1;
+	}
+
+	void left() {
+		grid_position.x -= 1;
+	}
+
+	void right() {
+		grid_position.x += 1;
+	}
+
+	void rotateclockwise() {
+		currentrotation = rotationAfter(CLOCKWISE);
+	}
+
+	void rotatecounterclockwise() {
+		currentrotation = rotationAfter(COUNTERCLOCKWISE);
+	}
+
+	int rotationAfter(int rotationDelta) const {
+		/* Returns the index of the rotation reached by turning one step CLOCKWISE or COUNTERCLOCKWISE, or none,
+		   wrapping around
+		*/
+		int rotation = currentrotation + rotationDelta;
+		int num_rotations = (int)shaperotations.size();
+		if (rotation < 0) {
+			return rotation + num_rotations;
+		}
+		return (rotation >= num_rotations) ? rotation - num_rotations : rotation;
+	}
+
+	void absoluteTilePositions(absolutecoords coords[4], int rotationDelta) const {
+		/* Returns the absolute grid positions of each tile in the shape 
+		   RotationDelta allows the user to get the absolute positions of the shapes clockwise or anticlockwise rotation
+		*/
+		const std::array<relativecoords, 4>& tile_positions = shaperotations.at(rotationAfter(rotationDelta));
+		for (int i = 0; i < 4; i++) {
+			absolutecoords current;
+			relativecoords tile_position = tile_positions[i];
+			current.x = grid_position.x + tile_position.relx;
+			current.y = grid_position.y + tile_position.rely;
+			coords[i] = current;
+		}
+	}
+
+	const std::array<relativecoords, 4>& currentTiles() const {
+		/* Returns the tiles of the current rotation, relative to the shape's reference point */
+		return shaperotations.at(currentrotation);
+	}
+
+	TileState getColour() const {
+		return colour;
+	}
+
+	PieceType getPieceType() const {
+		return piece;
+	}
+
+	absolutecoords getPosition() const {
+		return grid_position;
+	}
+
+	int getRotation() const {
+		return currentrotation;
+	}
+
+	float getLookAheadXAdjust() const {
+		return look_ahead_x_adjust;
+	}
+
+	float getLookAheadYAdjust() const {
+		return look_ahead_y_adjust;
+	}
+
+	const std::vector<std::array<relativecoords, 4>>& getRotations() const {
+		return shaperotations;
+	}
+};
+
+class Line : public Shape {
+public:
+	Line() {
+		
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 1,1 };
+		tile_positions[1] = relativecoords{ 1,2 };
+		tile_positions[2] = relativecoords{ 1,3 };
+		tile_positions[3] = relativecoords{ 1,4 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 2,1 };
+		tile_positions[3] = relativecoords{ 3,1 };
+		shaperotations.push_back(tile_positions);
+
+		look_ahead_y_adjust = -1.25;
+		look_ahead_x_adjust = -0.25;
+		colour = TileState::BLUE;
+		piece = PieceType::LINE;
+	}
+};
+
+
+class LShape : public Shape {
+public:
+	LShape() {
+
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 1,0 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 1,2 };
+		tile_positions[3] = relativecoords{ 2,0 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,0 };
+		tile_positions[1] = relativecoords{ 0,1 };
+		tile_positions[2] = relativecoords{ 1,1 };
+		tile_positions[3] = relativecoords{ 2,1 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,2 };
+		tile_positions[1] = relativecoords{ 1,2 };
+		tile_positions[2] = relativecoords{ 1,1 };
+		tile_positions[3] = relativecoords{ 1,0 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 2,1 };
+		tile_positions[3] = relativecoords{ 2,2 };
+		shaperotations.push_back(tile_positions);
+
+		look_ahead_y_adjust = -0.25;
+		look_ahead_x_adjust = -0.25;
+
+		colour = TileState::YELLOW;
+		piece = PieceType::LSHAPE;
+	}
+};
+
+
+class TShape : public Shape {
+public:
+	TShape() {
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 1,2 };
+		tile_positions[3] = relativecoords{ 2,1 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 1,2 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 1,0 };
+		tile_positions[3] = relativecoords{ 2,1 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 2,1 };
+		tile_positions[3] = relativecoords{ 1,0 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 1,2 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 1,0 };
+		tile_positions[3] = relativecoords{ 0,1 };
+		shaperotations.push_back(tile_positions);
+
+		look_ahead_y_adjust = -0.5;
+		look_ahead_x_adjust = -0.25;
+
+		colour = TileState::RED;
+		piece = PieceType::TSHAPE;
+	}
+};
+
+
+class SShape : public Shape {
+public:
+	SShape() {
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 0,0 };
+		tile_positions[1] = relativecoords{ 1,0 };
+		tile_positions[2] = relativecoords{ 1,1 };
+		tile_positions[3] = relativecoords{ 2,1 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 1,2 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 2,1 };
+		tile_positions[3] = relativecoords{ 2,0 };
+		shaperotations.push_back(tile_positions);
+
+		colour = TileState::PURPLE;
+		piece = PieceType::SSHAPE;
+	}
+};
+
+
+class ZShape : public Shape {
+public:
+	ZShape() {
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 1,0 };
+		tile_positions[3] = relativecoords{ 2,0 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 1,0 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 2,1 };
+		tile_positions[3] = relativecoords{ 2,2 };
+		shaperotations.push_back(tile_positions);
+
+		colour = TileState::PINK;
+		piece = PieceType::ZSHAPE;
+	}
+};
+
+class JShape : public Shape {
+public:
+	JShape() {
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 0,0 };
+		tile_positions[1] = relativecoords{ 1,0 };
+		tile_positions[2] = relativecoords{ 1,1 };
+		tile_positions[3] = relativecoords{ 1,2 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,2 };
+		tile_positions[1] = relativecoords{ 0,1 };
+		tile_positions[2] = relativecoords{ 1,1 };
+		tile_positions[3] = relativecoords{ 2,1 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 1,0 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 1,2 };
+		tile_positions[3] = relativecoords{ 2,2 };
+		shaperotations.push_back(tile_positions);
+
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,1 };
+		tile_positions[2] = relativecoords{ 2,1 };
+		tile_positions[3] = relativecoords{ 2,0 };
+		shaperotations.push_back(tile_positions);
+
+		look_ahead_y_adjust = -0.25;
+
+		colour = TileState::GREEN;
+		piece = PieceType::JSHAPE;
+	}
+};
+
+
+class Square : public Shape {
+public:
+	Square() {
+		std::array<relativecoords, 4> tile_positions;
+		tile_positions[0] = relativecoords{ 0,1 };
+		tile_positions[1] = relativecoords{ 1,0 };
+		tile_positions[2] = relativecoords{ 1,1 };
+		tile_positions[3] = relativecoords{ 0,0 };
+		shaperotations.push_back(tile_positions);
+
+		colour = TileState::CYAN;
+		piece = PieceType::SQUARE;
+	}
+};
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+/* Collision lookup tables.
+   For every piece, rotation and x offset we store the columns the piece covers in each row it spans, and whether
+   it lies between the walls. The game keeps a matching bitmask per board row, so testing whether a piece fits is
+   a handful of table loads and ANDs rather than a bounds check per tile.
+*/
+
+// Range of x offsets covered by the tables, anything outside is out of bounds
+const int COLLISION_MIN_X = -4;
+const int COLLISION_X_RANGE = 16;
+
+// Solid rows kept below the floor, and total rows of occupancy (rows from BOARD_HEIGHT up are always empty)
+const int FLOOR_ROWS = 4;
+const int OCCUPANCY_ROWS = FLOOR_ROWS + 32;
+const uint16_t FULL_ROW = (1 << BOARD_WIDTH) - 1;
+
+struct CollisionEntry {
+	uint16_t rows[4];	// Columns occupied in each row, starting at base_row
+	int base_row;		// Lowest row occupied, relative to the shape's reference point
+	bool in_bounds;		// Whether every tile lies between the walls
+};
+
+struct CollisionTable {
+	CollisionEntry entries[NUM_PIECE_TYPES][4][COLLISION_X_RANGE];
+	// Rotation reached from each rotation by turning COUNTERCLOCKWISE, not at all or CLOCKWISE, indexed by turn + 1
+	uint8_t rotation_after[NUM_PIECE_TYPES][4][3];
+};
+
+// Returns the collision tables, built from the rotations of each shape on first use
+const CollisionTable& collisionTable();
+
+// Returns a new shape of the given type
+Shape makeShape(PieceType piece);
+
+// Returns a random shape from the seven tetris pieces
+Shape generateRandomShape(PieceRandom& random);
+
+class LookAheadShape {
+private:
+	Shape next_shape;
+
+public:
+	explicit LookAheadShape(PieceRandom& random) {
+		next_shape = generateRandomShape(random);
+	}
+
+	const Shape& getShape() const {
+		return next_shape;
+	}
+
+	Shape doTransition(PieceRandom& random) {
+		Shape oldShape = next_shape;
+		next_shape = generateRandomShape(random);
+		return oldShape;
+	}
+
+};
+
+// Actions a player can take, in the order keyboard() maps them
+enum class Action : uint8_t { LEFT, RIGHT, SLAM, ROTATE_CLOCKWISE, ROTATE_COUNTERCLOCKWISE };
+const int NUM_ACTIONS = 5;
+
+struct ReplayEvent {
+	uint32_t tick;		// Number of ticks the game had run when the action was taken
+	Action action;
+};
+
+struct Replay {
+	/* Everything needed to reproduce a game: its seed and each action with the tick it happened on */
+	uint64_t seed = 0;
+	uint32_t end_tick = 0;	// Tick the recording stopped at, the game may not have been over
+	std::vector<ReplayEvent> events;
+};
+
+// Write a replay to a file / read one back. Both return false on failure.
+bool saveReplay(const Replay& replay, const char* path);
+bool loadReplay(Replay& replay, const char* path);
+
+// The same, at the current position of a file that's already open, so replays can be stored one after another
+bool writeReplay(const Replay& replay, FILE* file);
+bool readReplay(Replay& replay, FILE* file);
+
+inline void collapseRows(TileState board[][BOARD_ROWS], uint32_t rows) {
+	/* Remove the rows whose bits are set in rows and drop the rows above them into their place, as clearRows does.
+	   Spectators replay this on their own copy of a board (see spectator.h).
+	*/
+	int to = 0;
+	for (int from = 0; from < BOARD_HEIGHT; from++) {
+		if (rows & (1u << from)) {
+			continue;
+		}
+		if (to != from) {
+			for (int x = 0; x < BOARD_WIDTH; x++) {
+				board[x][to] = board[x][from];
+			}
+		}
+		to++;
+	}
+	for (; to < BOARD_HEIGHT; to++) {
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			board[x][to] = TileState::EMPTY;
+		}
+	}
+}
+
+class Game {
+private:
+	TileState Board[BOARD_WIDTH][BOARD_ROWS];
+	PieceRandom random;
+	Shape currentshape;
+	LookAheadShape lookahead;
+
+	// Bitmask of the occupied columns in each row, offset by FLOOR_ROWS. Mirrors Board for collision queries.
+	uint16_t occupancy[OCCUPANCY_ROWS];
+	// Held directly so collision queries don't go through collisionTable()'s initialisation guard
+	const CollisionTable* collisions = &collisionTable();
+
+	bool slamming = false;
+	int slamming_length = 0;
+	bool game_over = false;
+	int game_score = 0;
+	int count = 0;
+	int current_gravity = STARTING_GRAVITY;
+	int game_level = 1;
+	int total_rows_cleared = 0;
+	uint32_t ticks = 0;
+	uint32_t pieces_placed = 0;
+	uint32_t clears = 0;
+	uint32_t last_cleared_rows = 0;
+
+	void syncOccupancy() {
+		/* Rebuild the row bitmasks from the board */
+		for (int y = 0; y < OCCUPANCY_ROWS; y++) {
+			occupancy[y] = (y < FLOOR_ROWS) ? FULL_ROW : 0;
+		}
+		for (int y = 0; y < BOARD_HEIGHT; y++) {
+			for (int x = 0; x < BOARD_WIDTH; x++) {
+				if (Board[x][y] != TileState::EMPTY) {
+					occupancy[FLOOR_ROWS + y] |= 1 << x;
+				}
+			}
+		}
+	}
+
+	void collapseOccupancy(uint32_t rows) {
+		/* Remove the rows whose bits are set in rows from the row bitmasks, as collapseRows does for the board */
+		uint16_t* board_rows = &occupancy[FLOOR_ROWS];
+		int to = 0;
+		for (int from = 0; from < BOARD_HEIGHT; from++) {
+			if (!(rows & (1u << from))) {
+				board_rows[to++] = board_rows[from];
+			}
+		}
+		std::fill(&board_rows[to], &board_rows[BOARD_HEIGHT], (uint16_t)0);
+	}
+
+	bool shapeFits(int rotation, int x, int y) const {
+		/* Check whether the current shape, in the given rotation with its reference point at (x, y),
+		   lies between the walls, above the floor and clear of every filled tile.
+		*/
+		unsigned int column = x - COLLISION_MIN_X;
+		if (column >= COLLISION_X_RANGE) {
+			return false;
+		}
+
+		const CollisionEntry& entry = collisions->entries[static_cast<int>(currentshape.getPieceType())][rotation][column];
+		const uint16_t* rows = &occupancy[FLOOR_ROWS + y + entry.base_row];
+		uint16_t overlap = (entry.rows[0] & rows[0]) | (entry.rows[1] & rows[1]) | (entry.rows[2] & rows[2]) | (entry.rows[3] & rows[3]);
+		return entry.in_bounds & (overlap == 0);
+	}
+
+	void increase_level() {
+		game_level++;
+		game_score += game_level * 50;
+
+		if (current_gravity > 2) {
+			current_gravity -= 3;
+		}
+	}
+
+public:
+	explicit Game(uint64_t seed = 0) : random(seed), lookahead(random) {
+		/* Create first shape and setup empty board */
+		currentshape = generateRandomShape(random);
+		for (int x = 0; x < 10; x++) {
+			for (int y = 0; y < 25; y++) {
+				Board[x][y] = TileState::EMPTY;
+			}
+		}
+		syncOccupancy();
+	}
+
+	bool checkShapeRotate(int direction) const {
+		/* Check whether the shape can turn in the given direction.
+		
+			Return true if so, else false.
+		*/
+		absolutecoords position = currentshape.getPosition();
+		int piece = static_cast<int>(currentshape.getPieceType());
+		return shapeFits(collisions->rotation_after[piece][currentshape.getRotation()][direction + 1], position.x, position.y);
+	}
+
+	bool checkShapeMove(int direction) const {
+		/* Check whether the shape can move in the given direction 
+		
+			Returns true if so, else false
+		*/
+		absolutecoords position = currentshape.getPosition();
+		return shapeFits(currentshape.getRotation(), position.x + direction, position.y);
+	}
+
+	void left() {
+		if (checkShapeMove(LEFT)) {
+			currentshape.left();
+		}
+	}
+
+	void right() {
+		if (checkShapeMove(RIGHT)) {
+			currentshape.right();
+		}
+	}
+
+	void rotateclockwise() {
+		if (checkShapeRotate(CLOCKWISE)) {
+			currentshape.rotateclockwise();
+		}
+	}
+
+	void rotatecounterclockwise() {
+		if (checkShapeRotate(COUNTERCLOCKWISE)) {
+			currentshape.rotatecounterclockwise();
+		}
+	}
+
+	TileState getTile(int x, int y) const {
+		return Board[x][y];
+	}
+
+	void setTile(int x, int y, TileState state) {
+		/* Set one tile directly, for building boards in tools and benchmarks */
+		Board[x][y] = state;
+		if (y < BOARD_HEIGHT) {
+			uint16_t bit = (uint16_t)(1 << x);
+			occupancy[FLOOR_ROWS + y] = (state == TileState::EMPTY) ? (occupancy[FLOOR_ROWS + y] & ~bit) : (occupancy[FLOOR_ROWS + y] | bit);
+		}
+	}
+
+	void clearRows(int min, int max) {
+		/* Remove the full rows between min and max. Rows in that range that aren't full stay, and drop down with
+		   the rest.
+		*/
+		PROFILE_SCOPE("clearRows");
+		uint32_t rows = 0;
+		int num_rows = 0;
+		for (int y = min; y <= max; y++) {
+			if (occupancy[FLOOR_ROWS + y] == FULL_ROW) {
+				rows |= 1u << y;
+				num_rows++;
+			}
+		}
+		if (num_rows == 0) {
+			return;
+		}
+		total_rows_cleared += num_rows;
+		if (total_rows_cleared >= (game_level * 5)) {
+			increase_level();
+		}
+
+		// Increment game score by (100 * 2^(rows cleared-1)) + ((30 * game_level) * rows_cleared)
+		game_score += (100 << (num_rows - 1)) + ((30 * game_level) * num_rows);
+		collapseRows(Board, rows);
+		collapseOccupancy(rows);
+		clears++;
+		last_cleared_rows = rows;
+	}
+
+	void addGarbage(int rows, int hole) {
+		/* Push the board up by rows and fill the rows opened at the bottom with GARBAGE, apart from the hole column.
+		   The board moves in one shift of each column rather than a row at a time. Tiles pushed off the top end the
+		   game, and the falling shape moves up with the board if it would otherwise overlap it.
+		*/
+		PROFILE_SCOPE("addGarbage");
+		rows = std::min(rows, BOARD_HEIGHT);
+		if (rows <= 0) {
+			return;
+		}
+		for (int y = BOARD_HEIGHT - rows; y < BOARD_HEIGHT; y++) {
+			if (occupancy[FLOOR_ROWS + y] != 0) {
+				do_game_over();
+			}
+		}
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			std::copy_backward(&Board[x][0], &Board[x][BOARD_HEIGHT - rows], &Board[x][BOARD_HEIGHT]);
+			std::fill(&Board[x][0], &Board[x][rows], (x == hole) ? TileState::EMPTY : TileState::GARBAGE);
+		}
+		std::copy_backward(&occupancy[FLOOR_ROWS], &occupancy[FLOOR_ROWS + BOARD_HEIGHT - rows], &occupancy[FLOOR_ROWS + BOARD_HEIGHT]);
+		std::fill(&occupancy[FLOOR_ROWS], &occupancy[FLOOR_ROWS + rows], (uint16_t)(FULL_ROW & ~(1 << hole)));
+
+		absolutecoords position = currentshape.getPosition();
+		while (!shapeFits(currentshape.getRotation(), position.x, position.y)) {
+			currentshape.ascend();
+			position.y++;
+		}
+	}
+
+	void do_game_over() {
+		game_over = true;
+
+	}
+	void addShapeToBoard() {
+		/* Add the colour of the shape to all the tiles occupied by it
+		   Check to see if a line is completed
+		*/
+		PROFILE_SCOPE("addShapeToBoard");
+		absolutecoords tiles[4];
+		currentshape.absoluteTilePositions(tiles, 0);
+		for (auto tile : tiles) {
+			if (tile.y >= BOARD_HEIGHT) {
+				do_game_over();
+			}
+			Board[tile.x][tile.y] = currentshape.getColour();
+			if (tile.y < BOARD_HEIGHT) {
+				occupancy[FLOOR_ROWS + tile.y] |= 1 << tile.x;
+			}
+		}
+		pieces_placed++;
+
+		int min = -1;
+		int max = -1;
+
+		// Check to see if a row is completed
+		for (auto tile : tiles) {
+			// Find the lowest and highest rows completed
+			if (occupancy[FLOOR_ROWS + tile.y] == FULL_ROW) {
+				if ((min == -1) or (tile.y < min)) {
+					min = tile.y;
+				}
+
+				if ((max == -1) or (tile.y > max)) {
+					max = tile.y;
+				}
+			}
+		}
+
+		// If at least one row is completed, clear rows
+		if (min != -1) {
+			clearRows(min, max);
+		}	
+	}
+
+	
+
+	bool checkShapeCanFall() const {
+		/* Check the tiles below the falling shape and make sure they are all valid to be occupied
+		   Returns true if so, else false
+		*/
+		absolutecoords position = currentshape.getPosition();
+		return shapeFits(currentshape.getRotation(), position.x, position.y - 1);
+	}
+
+	void doGravity() {
+		/* If the shape can fall, then it does.
+		   Otherwise, it has hit the floor. Add it to the board and choose a new shape.
+		*/
+		PROFILE_SCOPE("doGravity");
+		if (checkShapeCanFall()) {
+			currentshape.descend();
+		}
+		else {
+			slamming = false;
+			game_score += slamming_length;
+			slamming_length = 0;
+			addShapeToBoard();
+			currentshape = lookahead.doTransition(random);
+		}
+	}
+
+	void slam() {
+		/* Set the slamming flag */
+		slamming = true;
+	}
+
+	bool tick() {
+		/* Advance the game by one timer tick.
+		   Each tick increments a counter. When the counter reaches the gravity delay, or the shape is being slammed,
+		   gravity is applied and the counter resets. Returns true if gravity was applied and the game needs redrawing.
+		*/
+		if (game_over) {
+			return false;
+		}
+		ticks++;
+		if ((count == current_gravity) or slamming) {
+			if (slamming) {
+				slamming_length++;
+			}
+			count = 0;
+			doGravity();
+			return true;
+		}
+		count += 1;
+		return false;
+	}
+
+	void apply(Action action) {
+		/* Carry out a player action, these are ignored once the game is over */
+		if (game_over) {
+			return;
+		}
+		switch (action) {
+		case Action::LEFT: left(); break;
+		case Action::RIGHT: right(); break;
+		case Action::SLAM: slam(); break;
+		case Action::ROTATE_CLOCKWISE: rotateclockwise(); break;
+		case Action::ROTATE_COUNTERCLOCKWISE: rotatecounterclockwise(); break;
+		}
+	}
+
+	const Shape& getCurrentShape() const {
+		return currentshape;
+	}
+
+	const Shape& getNextShape() const {
+		return lookahead.getShape();
+	}
+
+	bool isGameOver() const {
+		return game_over;
+	}
+
+	int getScore() const {
+		return game_score;
+	}
+
+	int getLevel() const {
+		return game_level;
+	}
+
+	int getRowsCleared() const {
+		return total_rows_cleared;
+	}
+
+	int getGravityDelay() const {
+		return current_gravity;
+	}
+
+	uint32_t getTicks() const {
+		return ticks;
+	}
+
+	uint32_t getPiecesPlaced() const {
+		return pieces_placed;
+	}
+
+	// Number of times rows have been cleared, and a bitmask of the rows removed the last time
+	uint32_t getClears() const {
+		return clears;
+	}
+
+	uint32_t getLastClearedRows() const {
+		return last_cleared_rows;
+	}
+
+	uint64_t checksum() const {
+		/* FNV-1a hash of everything that decides how the game goes on, to check that copies of a game kept on
+		   different machines are still in step. Tile colours are left out, they never change what happens.
+		*/
+		uint64_t hash = 14695981039346656037ULL;
+		auto mix = [&hash](uint64_t value) {
+			for (int i = 0; i < 8; i++) {
+				hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 1099511628211ULL;
+			}
+		};
+		for (int y = FLOOR_ROWS; y < FLOOR_ROWS + BOARD_HEIGHT; y += 4) {
+			mix((uint64_t)occupancy[y] | ((uint64_t)occupancy[y + 1] << 16) | ((uint64_t)occupancy[y + 2] << 32) | ((uint64_t)occupancy[y + 3] << 48));
+		}
+		absolutecoords position = currentshape.getPosition();
+		mix(random.getState());
+		mix(static_cast<uint64_t>(currentshape.getPieceType()) | ((uint64_t)currentshape.getRotation() << 8)
+			| ((uint64_t)(uint16_t)position.x << 16) | ((uint64_t)(uint16_t)position.y << 32)
+			| ((uint64_t)lookahead.getShape().getPieceType() << 48));
+		mix((uint64_t)slamming | ((uint64_t)game_over << 1) | ((uint64_t)(uint32_t)slamming_length << 32));
+		mix((uint64_t)(uint32_t)game_score | ((uint64_t)(uint32_t)count << 32));
+		mix((uint64_t)(uint32_t)current_gravity | ((uint64_t)(uint32_t)game_level << 32));
+		mix((uint64_t)(uint32_t)total_rows_cleared | ((uint64_t)ticks << 32));
+		mix(pieces_placed);
+		return hash;
+	}
+};
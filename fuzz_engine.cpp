@@ -0,0 +1,542 @@
+/* Property fuzzer for the game engine: plays random seeds with random actions on every core and checks the rules
+   after every step.
+
+   Usage: tetris_fuzz [options]
+     --seconds N        how long to run for (default: 10)
+     --seed N           seed of the first case, case i uses seed + i (default: 1)
+     --threads N        number of cases to run at once (default: one per core)
+     --out DIR          directory to write failing cases to (default: current directory)
+     --max-ticks N      ticks a case runs for at most (default: 20000)
+     --replay FILE      check a single replay instead of fuzzing, and report the first failure
+
+   Every tick about one in GARBAGE_ODDS also pushes 1 to 4 rows of garbage in under the board, with a random hole,
+   before its actions. Garbage is drawn from a sequence seeded by the case's seed rather than stored as events, so
+   a replay checked with --replay gets the same garbage however it was shrunk; render_replays draws it without.
+
+   Every action, garbage step and tick that applies gravity is followed by a check of:
+     overlap        the falling shape lies inside the board and doesn't overlap a filled tile
+     collision      checkShapeMove, checkShapeRotate and checkShapeCanFall agree with a check tile by tile
+     full row       no complete row is left on the board after a shape locks
+     board          the board matches a model that places each locked shape and removes exactly the full rows,
+                    and its column heights match the model's
+     score          the score only changes when a shape locks, by the slam bonus plus the row clearing and level
+                    formulas in clearRows and increase_level
+     game over      the game ends exactly when a shape locks with a tile outside the playable area, or garbage
+                    pushes a tile off the top
+     garbage        the board matches the model shifted up with the garbage rows added under it
+
+   The first failure of each kind is shrunk to as few actions and ticks as still fail the same way, and written to
+   DIR/fuzz_<kind>_<seed>.replay. These are ordinary replays, so render_replays can draw them and --replay checks
+   them again.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <set>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+
+typedef std::chrono::steady_clock fuzz_clock;
+
+struct FuzzOptions {
+	double seconds = 10;
+	uint64_t seed = 1;
+	unsigned int threads = 0;
+	std::string out_dir = ".";
+	uint32_t max_ticks = 20000;
+};
+
+// One tick in this many pushes garbage in under the board
+const int GARBAGE_ODDS = 200;
+
+struct Failure {
+	std::string kind;		// Short name of the invariant, used to tell failures apart
+	std::string detail;
+	uint32_t tick = 0;
+};
+
+static bool tilesFit(const uint16_t rows[BOARD_ROWS], const absolutecoords tiles[4], int dx, int dy) {
+	/* Whether the tiles, moved by (dx, dy), are between the walls, above the floor and on empty tiles */
+	for (int i = 0; i < 4; i++) {
+		int x = tiles[i].x + dx;
+		int y = tiles[i].y + dy;
+		if ((x < 0) or (x >= BOARD_WIDTH) or (y < 0) or ((y < BOARD_ROWS) and (rows[y] & (1 << x)))) {
+			return false;
+		}
+	}
+	return true;
+}
+
+class InvariantChecker {
+	/* Follows one game and checks it after each step against what the rules say should have happened. The model
+	   board is kept as a bitmask of filled columns per row; it is compared with the game's board whenever a shape
+	   locks, which is the only time the board changes, and the move checks in between are made against it.
+	*/
+private:
+	uint16_t model[BOARD_ROWS] = {};
+	absolutecoords falling[4];	// Tiles of the shape before the step, where it locks if the step locks it
+	uint32_t pieces_placed = 0;
+	int score = 0;
+	int level = 1;
+	int rows_cleared = 0;
+	bool game_over = false;
+
+	void remember(const Game& game) {
+		game.getCurrentShape().absoluteTilePositions(falling, 0);
+		pieces_placed = game.getPiecesPlaced();
+		score = game.getScore();
+		level = game.getLevel();
+		rows_cleared = game.getRowsCleared();
+		game_over = game.isGameOver();
+	}
+
+	bool fail(Failure& failure, const char* kind, const std::string& detail, const Game& game) {
+		failure.kind = kind;
+		failure.detail = detail;
+		failure.tick = game.getTicks();
+		return false;
+	}
+
+	static void readBoard(const Game& game, uint16_t board[BOARD_HEIGHT]) {
+		for (int y = 0; y < BOARD_HEIGHT; y++) {
+			board[y] = 0;
+			for (int x = 0; x < BOARD_WIDTH; x++) {
+				if (game.getTile(x, y) != TileState::EMPTY) {
+					board[y] |= 1 << x;
+				}
+			}
+		}
+	}
+
+	bool compareBoard(const uint16_t board[BOARD_HEIGHT], const char* kind, const Game& game, Failure& failure) {
+		/* Compare the game's board with the model, column heights first as they make the clearer report */
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			int height = 0;
+			int model_height = 0;
+			for (int y = 0; y < BOARD_HEIGHT; y++) {
+				if (board[y] & (1 << x)) {
+					height = y + 1;
+				}
+				if (model[y] & (1 << x)) {
+					model_height = y + 1;
+				}
+			}
+			if (height != model_height) {
+				char detail[96];
+				snprintf(detail, sizeof(detail), "column %d is %d high, expected %d", x, height, model_height);
+				return fail(failure, kind, detail, game);
+			}
+		}
+		for (int y = 0; y < BOARD_HEIGHT; y++) {
+			uint16_t differ = board[y] ^ model[y];
+			if (differ != 0) {
+				int x = __builtin_ctz(differ);
+				char detail[96];
+				snprintf(detail, sizeof(detail), "tile (%d, %d) is %s, expected %s", x, y,
+					(board[y] & (1 << x)) ? "filled" : "empty", (model[y] & (1 << x)) ? "filled" : "empty");
+				return fail(failure, kind, detail, game);
+			}
+		}
+		return true;
+	}
+
+	bool checkLock(const Game& game, Failure& failure) {
+		/* A shape has locked: place it in the model, clear the model's full rows and compare */
+		if (game.getPiecesPlaced() != pieces_placed + 1) {
+			return fail(failure, "board", "more than one shape locked in a step", game);
+		}
+		bool above_top = false;
+		for (int i = 0; i < 4; i++) {
+			if (falling[i].y >= BOARD_HEIGHT) {
+				above_top = true;
+			}
+			if (falling[i].y < BOARD_ROWS) {
+				model[falling[i].y] |= 1 << falling[i].x;
+			}
+		}
+		if (game.isGameOver() != above_top) {
+			char detail[96];
+			snprintf(detail, sizeof(detail), "shape locked %s the top but game over is %s",
+				above_top ? "above" : "below", game.isGameOver() ? "set" : "not set");
+			return fail(failure, "game_over", detail, game);
+		}
+
+		int cleared = 0;
+		int kept = 0;
+		for (int y = 0; y < BOARD_HEIGHT; y++) {
+			if (model[y] == FULL_ROW) {
+				cleared++;
+			}
+			else {
+				model[kept++] = model[y];
+			}
+		}
+		for (; kept < BOARD_HEIGHT; kept++) {
+			model[kept] = 0;
+		}
+
+		uint16_t board[BOARD_HEIGHT];
+		readBoard(game, board);
+		for (int y = 0; y < BOARD_HEIGHT; y++) {
+			if (board[y] == FULL_ROW) {
+				return fail(failure, "full_row", "row " + std::to_string(y) + " is full after the shape locked", game);
+			}
+		}
+		if (!compareBoard(board, "board", game, failure)) {
+			return false;
+		}
+
+		// Score: slam bonus, then increase_level's bonus and clearRows' formula at the new level
+		if (game.getRowsCleared() - rows_cleared != cleared) {
+			return fail(failure, "score", "rows cleared went up by " + std::to_string(game.getRowsCleared() - rows_cleared) +
+				", expected " + std::to_string(cleared), game);
+		}
+		int expected_level = level + (((cleared > 0) and (game.getRowsCleared() >= level * 5)) ? 1 : 0);
+		if (game.getLevel() != expected_level) {
+			return fail(failure, "score", "level is " + std::to_string(game.getLevel()) + ", expected " + std::to_string(expected_level), game);
+		}
+		int formula = 0;
+		if (expected_level != level) {
+			formula += expected_level * 50;
+		}
+		if (cleared > 0) {
+			formula += (100 << (cleared - 1)) + 30 * expected_level * cleared;
+		}
+		int slam_bonus = game.getScore() - score - formula;
+		if ((slam_bonus < 0) or (slam_bonus > BOARD_ROWS)) {
+			return fail(failure, "score", "score went up by " + std::to_string(game.getScore() - score) +
+				", the formulas give " + std::to_string(formula) + " plus a slam bonus of at most " + std::to_string(BOARD_ROWS), game);
+		}
+		return true;
+	}
+
+public:
+	explicit InvariantChecker(const Game& game) {
+		remember(game);
+	}
+
+	bool check(const Game& game, Failure& failure) {
+		/* Check the game after an action or a tick. Returns false, describing the problem, if a rule was broken. */
+		if (game.getPiecesPlaced() != pieces_placed) {
+			if (!checkLock(game, failure)) {
+				return false;
+			}
+		}
+		else if ((game.getScore() != score) or (game.getLevel() != level) or (game.getRowsCleared() != rows_cleared)) {
+			return fail(failure, "score", "score changed without a shape locking", game);
+		}
+		else if (game.isGameOver() != game_over) {
+			return fail(failure, "game_over", "game over changed without a shape locking", game);
+		}
+		return checkShape(game, failure);
+	}
+
+	bool checkGarbage(const Game& game, int rows, int hole, Failure& failure) {
+		/* Check the game after addGarbage(rows, hole): the model moves up by rows with the garbage under it, and
+		   nothing else about the game changes unless tiles went off the top
+		*/
+		bool pushed_off = false;
+		for (int y = BOARD_HEIGHT - rows; y < BOARD_HEIGHT; y++) {
+			pushed_off |= (model[y] != 0);
+		}
+		std::copy_backward(&model[0], &model[BOARD_HEIGHT - rows], &model[BOARD_HEIGHT]);
+		std::fill(&model[0], &model[rows], (uint16_t)(FULL_ROW & ~(1 << hole)));
+
+		if (game.isGameOver() != (game_over or pushed_off)) {
+			char detail[96];
+			snprintf(detail, sizeof(detail), "garbage %s tiles off the top but game over is %s",
+				pushed_off ? "pushed" : "didn't push", game.isGameOver() ? "set" : "not set");
+			return fail(failure, "game_over", detail, game);
+		}
+		if ((game.getPiecesPlaced() != pieces_placed) or (game.getScore() != score) or (game.getLevel() != level)
+			or (game.getRowsCleared() != rows_cleared)) {
+			return fail(failure, "garbage", "garbage locked a shape or changed the score", game);
+		}
+		uint16_t board[BOARD_HEIGHT];
+		readBoard(game, board);
+		if (!compareBoard(board, "garbage", game, failure)) {
+			return false;
+		}
+		return checkShape(game, failure);
+	}
+
+	bool checkShape(const Game& game, Failure& failure) {
+		/* The falling shape is on empty tiles, and the move checks agree with the model */
+		if (!game.isGameOver()) {
+			absolutecoords tiles[4];
+			const Shape& shape = game.getCurrentShape();
+			shape.absoluteTilePositions(tiles, 0);
+			if (!tilesFit(model, tiles, 0, 0)) {
+				return fail(failure, "overlap", "the falling shape overlaps a tile or a wall", game);
+			}
+			if ((game.checkShapeMove(LEFT) != tilesFit(model, tiles, -1, 0)) or (game.checkShapeMove(RIGHT) != tilesFit(model, tiles, 1, 0))
+				or (game.checkShapeCanFall() != tilesFit(model, tiles, 0, -1))) {
+				return fail(failure, "collision", "a move check disagrees with the board", game);
+			}
+			absolutecoords rotated[4];
+			shape.absoluteTilePositions(rotated, CLOCKWISE);
+			bool clockwise = tilesFit(model, rotated, 0, 0);
+			shape.absoluteTilePositions(rotated, COUNTERCLOCKWISE);
+			bool counterclockwise = tilesFit(model, rotated, 0, 0);
+			if ((game.checkShapeRotate(CLOCKWISE) != clockwise) or (game.checkShapeRotate(COUNTERCLOCKWISE) != counterclockwise)) {
+				return fail(failure, "collision", "a rotation check disagrees with the board", game);
+			}
+		}
+		remember(game);
+		return true;
+	}
+};
+
+static bool garbageStep(Game& game, InvariantChecker& checker, PieceRandom& garbage, Failure& failure, uint64_t& steps) {
+	/* Push garbage in under the board one tick in GARBAGE_ODDS, and check the result. Returns false on a failure. */
+	if (game.isGameOver() or (garbage.nextBelow(GARBAGE_ODDS) != 0)) {
+		return true;
+	}
+	int rows = 1 + garbage.nextBelow(4);
+	int hole = garbage.nextBelow(BOARD_WIDTH);
+	game.addGarbage(rows, hole);
+	steps++;
+	return checker.checkGarbage(game, rows, hole, failure);
+}
+
+static PieceRandom garbageRandom(uint64_t seed) {
+	return PieceRandom(seed ^ 0x6A7BA6E6A7BA6E6AULL);
+}
+
+static bool runReplay(const Replay& replay, Failure& failure, uint32_t& pieces) {
+	/* Play a replay, checking after every step. Returns false at the first failure. */
+	Game game(replay.seed);
+	InvariantChecker checker(game);
+	PieceRandom garbage = garbageRandom(replay.seed);
+	uint64_t steps = 0;
+	size_t next_event = 0;
+	for (uint32_t tick = 0; (tick < replay.end_tick) and !game.isGameOver(); tick++) {
+		if (!garbageStep(game, checker, garbage, failure, steps)) {
+			pieces = game.getPiecesPlaced();
+			return false;
+		}
+		while ((next_event < replay.events.size()) and (replay.events[next_event].tick == tick)) {
+			game.apply(replay.events[next_event].action);
+			next_event++;
+			if (!checker.check(game, failure)) {
+				pieces = game.getPiecesPlaced();
+				return false;
+			}
+		}
+		// A tick without gravity only moves the counter on, so there is nothing to check
+		if (game.tick() and !checker.check(game, failure)) {
+			pieces = game.getPiecesPlaced();
+			return false;
+		}
+	}
+	pieces = game.getPiecesPlaced();
+	return true;
+}
+
+static bool failsTheSame(const Replay& replay, const std::string& kind) {
+	Failure failure;
+	uint32_t pieces;
+	return !runReplay(replay, failure, pieces) and (failure.kind == kind);
+}
+
+static Replay shrink(Replay replay, const Failure& failure) {
+	/* Cut the replay down to the failing tick, then drop runs of events, halving the run length each pass, for as
+	   long as it still fails the same way
+	*/
+	replay.end_tick = failure.tick + 1;
+	while (!replay.events.empty() and (replay.events.back().tick > failure.tick)) {
+		replay.events.pop_back();
+	}
+
+	for (size_t run = std::max<size_t>(1, replay.events.size() / 2); ; run /= 2) {
+		for (size_t start = 0; start < replay.events.size(); ) {
+			Replay candidate = replay;
+			size_t end = std::min(start + run, candidate.events.size());
+			candidate.events.erase(candidate.events.begin() + start, candidate.events.begin() + end);
+			if (failsTheSame(candidate, failure.kind)) {
+				replay = candidate;
+			}
+			else {
+				start += run;
+			}
+		}
+		if (run == 1) {
+			break;
+		}
+	}
+
+	// The failure may now happen sooner
+	Failure shrunk;
+	uint32_t pieces;
+	if (!runReplay(replay, shrunk, pieces)) {
+		replay.end_tick = shrunk.tick + 1;
+	}
+	return replay;
+}
+
+class FailureLog {
+	/* Shrinks and saves the first failure of each kind, shared between threads */
+private:
+	const FuzzOptions& options;
+	std::mutex mutex;
+	std::set<std::string> seen;
+
+public:
+	explicit FailureLog(const FuzzOptions& options) : options(options) {}
+
+	size_t count() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return seen.size();
+	}
+
+	void report(const Replay& replay, const Failure& failure) {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			if (!seen.insert(failure.kind).second) {
+				return;
+			}
+		}
+		Replay shrunk = shrink(replay, failure);
+		std::string path = options.out_dir + "/fuzz_" + failure.kind + "_" + std::to_string(replay.seed) + ".replay";
+		bool saved = saveReplay(shrunk, path.c_str());
+
+		std::lock_guard<std::mutex> lock(mutex);
+		printf("%s at tick %u of seed %llu: %s\n", failure.kind.c_str(), failure.tick, (unsigned long long)replay.seed, failure.detail.c_str());
+		printf("    shrunk from %zu to %zu actions over %u ticks, %s %s\n", replay.events.size(), shrunk.events.size(), shrunk.end_tick,
+			saved ? "saved to" : "could not write", path.c_str());
+		fflush(stdout);
+	}
+};
+
+struct FuzzTotals {
+	std::atomic<uint64_t> cases{ 0 };
+	std::atomic<uint64_t> pieces{ 0 };
+	std::atomic<uint64_t> steps{ 0 };
+};
+
+static void fuzz(const FuzzOptions& options, std::atomic<uint64_t>& next_case, const fuzz_clock::time_point& deadline, FailureLog& log, FuzzTotals& totals) {
+	Replay replay;
+	while (fuzz_clock::now() < deadline) {
+		// Cases are handed out in blocks so threads rarely touch the shared counter
+		uint64_t first = next_case.fetch_add(64);
+		uint64_t pieces = 0;
+		uint64_t steps = 0;
+		for (uint64_t i = first; i < first + 64; i++) {
+			replay.seed = options.seed + i;
+			replay.events.clear();
+			Game game(replay.seed);
+			InvariantChecker checker(game);
+			PieceRandom actions(replay.seed ^ 0xF0220F0220F0220FULL);
+			PieceRandom garbage = garbageRandom(replay.seed);
+			Failure failure;
+			bool passed = true;
+
+			uint32_t tick = 0;
+			for (; passed and (tick < options.max_ticks) and !game.isGameOver(); tick++) {
+				passed = garbageStep(game, checker, garbage, failure, steps);
+				// Up to two actions a tick, a slam about one time in five so shapes lock at all heights
+				int count = actions.nextBelow(4);
+				for (int a = 0; passed and (a < count) and (a < 2); a++) {
+					Action action = static_cast<Action>(actions.nextBelow(NUM_ACTIONS));
+					replay.events.push_back(ReplayEvent{ tick, action });
+					game.apply(action);
+					passed = checker.check(game, failure);
+					steps++;
+				}
+				if (passed and game.tick()) {
+					passed = checker.check(game, failure);
+					steps++;
+				}
+			}
+			pieces += game.getPiecesPlaced();
+			if (!passed) {
+				replay.end_tick = tick + 1;
+				log.report(replay, failure);
+			}
+		}
+		totals.cases += 64;
+		totals.pieces += pieces;
+		totals.steps += steps;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	FuzzOptions options;
+	const char* replay_path = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--seconds") and has_value) {
+			options.seconds = atof(argv[++i]);
+		}
+		else if ((arg == "--seed") and has_value) {
+			options.seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if ((arg == "--threads") and has_value) {
+			options.threads = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--out") and has_value) {
+			options.out_dir = argv[++i];
+		}
+		else if ((arg == "--max-ticks") and has_value) {
+			options.max_ticks = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--replay") and has_value) {
+			replay_path = argv[++i];
+		}
+		else {
+			fprintf(stderr, "Usage: %s [--seconds N] [--seed N] [--threads N] [--out DIR] [--max-ticks N] [--replay FILE]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	if (replay_path != nullptr) {
+		Replay replay;
+		if (!loadReplay(replay, replay_path)) {
+			fprintf(stderr, "Could not read replay %s\n", replay_path);
+			return 2;
+		}
+		Failure failure;
+		uint32_t pieces;
+		if (runReplay(replay, failure, pieces)) {
+			printf("No failures in %u ticks, %u pieces\n", replay.end_tick, pieces);
+			return 0;
+		}
+		printf("%s at tick %u: %s\n", failure.kind.c_str(), failure.tick, failure.detail.c_str());
+		return 1;
+	}
+
+	unsigned int num_threads = options.threads;
+	if (num_threads == 0) {
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	FailureLog log(options);
+	FuzzTotals totals;
+	std::atomic<uint64_t> next_case(0);
+	fuzz_clock::time_point start = fuzz_clock::now();
+	fuzz_clock::time_point deadline = start + std::chrono::duration_cast<fuzz_clock::duration>(std::chrono::duration<double>(options.seconds));
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < num_threads; t++) {
+		workers.emplace_back([&] {
+			fuzz(options, next_case, deadline, log, totals);
+		});
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	double elapsed = std::chrono::duration<double>(fuzz_clock::now() - start).count();
+	printf("Ran %llu cases on %u threads in %.1f s: %.0f pieces/s, %.0f checked steps/s, %zu kinds of failure\n",
+		(unsigned long long)totals.cases.load(), num_threads, elapsed, totals.pieces / elapsed, totals.steps / elapsed, log.count());
+	return (log.count() == 0) ? 0 : 1;
+}
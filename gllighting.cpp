@@ -0,0 +1,201 @@
+#define GL_GLEXT_PROTOTYPES
+
+#include "gllighting.h"
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <vector>
+
+#include "render.h"
+
+static_assert(sizeof(Colour) == 3 * sizeof(float), "TILE_PALETTE is uploaded as an array of vec3");
+static_assert(NUM_TILE_STATES == 9, "The shader's palette has a colour for each TileState");
+
+static const char* const VERTEX_SHADER = R"(
+#version 120
+
+uniform vec3 palette[9];
+uniform int tile;
+uniform float cube_size;
+
+uniform vec3 light_direction[2];	// Unit vectors towards the lights, in eye coordinates
+uniform vec3 half_vector[2];		// Halfway between each light and the viewer at infinity
+uniform float ambient;				// Global ambient plus both lights' ambient
+uniform float light_diffuse;
+uniform float light_specular[2];	// Each light's specular times the material's
+uniform float shininess;
+
+void main() {
+	gl_Position = gl_ModelViewProjectionMatrix * vec4(gl_Vertex.xyz * cube_size, 1.0);
+	vec3 normal = normalize(gl_NormalMatrix * gl_Normal);
+	vec3 colour = (tile >= 0) ? palette[tile] : gl_Color.rgb;
+
+	float diffuse = ambient;
+	float specular = 0.0;
+	for (int i = 0; i < 2; i++) {
+		float intensity = dot(normal, light_direction[i]);
+		if (intensity > 0.0) {
+			diffuse += intensity * light_diffuse;
+			specular += light_specular[i] * pow(max(dot(normal, half_vector[i]), 0.0), shininess);
+		}
+	}
+	gl_FrontColor = vec4(min(colour * diffuse + specular, 1.0), 1.0);
+}
+)";
+
+static const char* const FRAGMENT_SHADER = R"(
+#version 120
+
+void main() {
+	gl_FragColor = gl_Color;
+}
+)";
+
+static void normalise(float vector[3]) {
+	float length = std::sqrt(vector[0] * vector[0] + vector[1] * vector[1] + vector[2] * vector[2]);
+	for (int i = 0; i < 3; i++) {
+		vector[i] /= length;
+	}
+}
+
+static GLuint compileShader(GLenum type, const char* source) {
+	/* Returns 0, after printing the log, if the shader doesn't compile */
+	GLuint shader = glCreateShader(type);
+	glShaderSource(shader, 1, &source, nullptr);
+	glCompileShader(shader);
+	GLint compiled = GL_FALSE;
+	glGetShaderiv(shader, GL_COMPILE_STATUS, &compiled);
+	if (compiled != GL_TRUE) {
+		char log[1024] = "";
+		glGetShaderInfoLog(shader, sizeof(log), nullptr, log);
+		fprintf(stderr, "Lighting shader didn't compile: %s\n", log);
+		glDeleteShader(shader);
+		return 0;
+	}
+	return shader;
+}
+
+bool ShaderLighting::init() {
+	const char* version = (const char*)glGetString(GL_VERSION);
+	if ((version == nullptr) or (atoi(version) < 2)) {
+		fprintf(stderr, "OpenGL 2.0 is needed for the lighting shader, have %s\n", (version != nullptr) ? version : "none");
+		return false;
+	}
+
+	GLuint vertex_shader = compileShader(GL_VERTEX_SHADER, VERTEX_SHADER);
+	GLuint fragment_shader = compileShader(GL_FRAGMENT_SHADER, FRAGMENT_SHADER);
+	if ((vertex_shader == 0) or (fragment_shader == 0)) {
+		glDeleteShader(vertex_shader);
+		glDeleteShader(fragment_shader);
+		return false;
+	}
+	program = glCreateProgram();
+	glAttachShader(program, vertex_shader);
+	glAttachShader(program, fragment_shader);
+	glLinkProgram(program);
+	glDeleteShader(vertex_shader);
+	glDeleteShader(fragment_shader);
+	GLint linked = GL_FALSE;
+	glGetProgramiv(program, GL_LINK_STATUS, &linked);
+	if (linked != GL_TRUE) {
+		char log[1024] = "";
+		glGetProgramInfoLog(program, sizeof(log), nullptr, log);
+		fprintf(stderr, "Lighting shader didn't link: %s\n", log);
+		glDeleteProgram(program);
+		program = 0;
+		return false;
+	}
+	tile_location = glGetUniformLocation(program, "tile");
+	size_location = glGetUniformLocation(program, "cube_size");
+
+	// The lights and material never change, so the lighting equation's constants are worked out here once
+	float light_direction[2][3];
+	float half_vector[2][3];
+	float light_specular[2];
+	for (int i = 0; i < 2; i++) {
+		for (int axis = 0; axis < 3; axis++) {
+			light_direction[i][axis] = LIGHT_POSITIONS[i][axis];
+		}
+		normalise(light_direction[i]);
+		half_vector[i][0] = light_direction[i][0];
+		half_vector[i][1] = light_direction[i][1];
+		half_vector[i][2] = light_direction[i][2] + 1.0f;
+		normalise(half_vector[i]);
+		light_specular[i] = LIGHT_SPECULAR[i] * MATERIAL_SPECULAR[0];
+	}
+	glUseProgram(program);
+	glUniform3fv(glGetUniformLocation(program, "palette"), NUM_TILE_STATES, &TILE_PALETTE[0].r);
+	glUniform3fv(glGetUniformLocation(program, "light_direction"), 2, &light_direction[0][0]);
+	glUniform3fv(glGetUniformLocation(program, "half_vector"), 2, &half_vector[0][0]);
+	glUniform1f(glGetUniformLocation(program, "ambient"), GLOBAL_AMBIENT + 2 * LIGHT_AMBIENT[0]);
+	glUniform1f(glGetUniformLocation(program, "light_diffuse"), LIGHT_DIFFUSE[0]);
+	glUniform1fv(glGetUniformLocation(program, "light_specular"), 2, light_specular);
+	glUniform1f(glGetUniformLocation(program, "shininess"), MATERIAL_SHININESS);
+	glUseProgram(0);
+
+	// A cube of side 1 as six quads, each vertex a position followed by its face's unit normal
+	static const float normals[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	static const float corners[6][4][3] = {
+		{ { 1, -1, -1 }, { 1, 1, -1 }, { 1, 1, 1 }, { 1, -1, 1 } },
+		{ { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, 1 }, { -1, 1, -1 } },
+		{ { -1, 1, -1 }, { -1, 1, 1 }, { 1, 1, 1 }, { 1, 1, -1 } },
+		{ { -1, -1, -1 }, { 1, -1, -1 }, { 1, -1, 1 }, { -1, -1, 1 } },
+		{ { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } },
+		{ { -1, -1, -1 }, { -1, 1, -1 }, { 1, 1, -1 }, { 1, -1, -1 } },
+	};
+	std::vector<float> vertices;
+	for (int face = 0; face < 6; face++) {
+		for (int corner = 0; corner < 4; corner++) {
+			for (int axis = 0; axis < 3; axis++) {
+				vertices.push_back(corners[face][corner][axis] * 0.5f);
+			}
+			for (int axis = 0; axis < 3; axis++) {
+				vertices.push_back(normals[face][axis]);
+			}
+		}
+	}
+	glGenBuffers(1, &cube_buffer);
+	glBindBuffer(GL_ARRAY_BUFFER, cube_buffer);
+	glBufferData(GL_ARRAY_BUFFER, vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	return true;
+}
+
+void ShaderLighting::begin() {
+	glUseProgram(program);
+	glBindBuffer(GL_ARRAY_BUFFER, cube_buffer);
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_NORMAL_ARRAY);
+	glVertexPointer(3, GL_FLOAT, 6 * sizeof(float), (const void*)0);
+	glNormalPointer(GL_FLOAT, 6 * sizeof(float), (const void*)(3 * sizeof(float)));
+}
+
+void ShaderLighting::end() {
+	glDisableClientState(GL_VERTEX_ARRAY);
+	glDisableClientState(GL_NORMAL_ARRAY);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glUseProgram(0);
+}
+
+void ShaderLighting::setUniforms(int tile, float size) {
+	if (tile != current_tile) {
+		glUniform1i(tile_location, tile);
+		current_tile = tile;
+	}
+	if (size != current_size) {
+		glUniform1f(size_location, size);
+		current_size = size;
+	}
+}
+
+void ShaderLighting::drawCube(int tile, float size) {
+	setUniforms(tile, size);
+	glDrawArrays(GL_QUADS, 0, 24);
+}
+
+void ShaderLighting::beginLines(int tile) {
+	/* The vertex shader scales every vertex by cube_size, so lines keep theirs with a size of 1 */
+	setUniforms(tile, 1.0f);
+}
@@ -0,0 +1,59 @@
+#pragma once
+
+/* Lighting the cubes with a GLSL program instead of OpenGL's fixed-function lights.
+
+   The fixed-function setup in Tetris.cpp (init_lights) has GL_NORMALIZE and GL_AUTO_NORMAL on and takes the cube
+   colours through GL_COLOR_MATERIAL, so every normal of every glutSolidCube is renormalised and every colour change
+   is a material change. Here the cube is a vertex buffer of 24 vertices with unit normals, built once; the lights
+   and material from render.h are uniforms set once; and TILE_PALETTE is a uniform array, so a cube in a new tile
+   colour costs one integer uniform and a cube in the same colour costs nothing.
+
+   The shader evaluates the same equation fixed-function lighting does with GL_COLOR_MATERIAL (as SoftwareCanvas
+   does on the CPU), per vertex. The four vertices of a face share a normal, so faces come out flat, as they do with
+   GL_FLAT. The shader normalises each normal, as GL_NORMALIZE does, since text is drawn under a scale.
+
+   Lines and stroked text drawn while lighting is on go through the program too, as they went through the
+   fixed-function lights. Before drawing them the window sets the current glNormal to LINE_NORMAL
+   (render.h), the normal SoftwareCanvas lights them with.
+*/
+
+#ifdef __APPLE__
+	#include <OpenGL/gl.h>
+#else
+	#include <GL/gl.h>
+#endif
+
+class ShaderLighting {
+private:
+	GLuint program = 0;
+	GLuint cube_buffer = 0;
+	GLint tile_location = -1;
+	GLint size_location = -1;
+
+	// Values the uniforms were last set to, so unchanged ones aren't set again
+	int current_tile = -2;
+	float current_size = -1.0f;
+
+	void setUniforms(int tile, float size);
+
+public:
+	// Compile the program and upload the cube and the uniforms that never change. Needs a current context with
+	// OpenGL 2.0. Returns false, after printing why, if the shader can't be used.
+	bool init();
+
+	bool isReady() const {
+		return program != 0;
+	}
+
+	// Bind the program and the cube buffer, and unbind them to go back to fixed-function drawing
+	void begin();
+	void end();
+
+	// Draw a cube centred on the current origin in a TILE_PALETTE colour, or in the current glColor if tile is -1.
+	// Only between begin() and end().
+	void drawCube(int tile, float size);
+
+	// Get ready to draw lines with glBegin and glVertex, lit like cubes with the current glNormal, in a TILE_PALETTE
+	// colour or the current glColor. Only between begin() and end().
+	void beginLines(int tile);
+};
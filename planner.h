@@ -0,0 +1,128 @@
+#pragma once
+
+/* A greedy placement policy, used by the tools that play games on their own (tetris_selfplay, tetris_versus).
+
+   When a shape appears, planPlacement tries every rotation and column, drops the shape straight down, and scores
+   the board it would leave by its height, holes, bumpiness and rows cleared. actionTowards then gives the action
+   that takes the shape one step closer to the chosen placement, so a player following it rotates, moves and slams
+   one action per tick.
+*/
+
+#include <cstdlib>
+#include <stdint.h>
+
+#include "engine.h"
+
+struct Placement {
+	int rotation;
+	int x;
+};
+
+inline void boardRows(const Game& game, uint16_t rows[OCCUPANCY_ROWS]) {
+	/* Occupied columns of each row, offset by FLOOR_ROWS like Game's own occupancy */
+	for (int y = 0; y < OCCUPANCY_ROWS; y++) {
+		rows[y] = (y < FLOOR_ROWS) ? FULL_ROW : 0;
+	}
+	for (int y = 0; y < BOARD_HEIGHT; y++) {
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			if (game.getTile(x, y) != TileState::EMPTY) {
+				rows[FLOOR_ROWS + y] |= 1 << x;
+			}
+		}
+	}
+}
+
+inline bool placementFits(const uint16_t rows[OCCUPANCY_ROWS], const CollisionEntry& entry, int y) {
+	const uint16_t* at = &rows[FLOOR_ROWS + y + entry.base_row];
+	return entry.in_bounds and (((entry.rows[0] & at[0]) | (entry.rows[1] & at[1]) | (entry.rows[2] & at[2]) | (entry.rows[3] & at[3])) == 0);
+}
+
+inline double scorePlacement(const uint16_t rows[OCCUPANCY_ROWS], const CollisionEntry& entry, int y) {
+	/* How good the board is once the piece locks at y: fewer holes, lower and flatter stacks, more rows cleared */
+	uint16_t board[BOARD_HEIGHT + 4];
+	int height = 0;
+	int cleared = 0;
+	for (int row = 0; row < BOARD_HEIGHT + 4; row++) {
+		uint16_t bits = rows[FLOOR_ROWS + row];
+		int relative = row - (y + entry.base_row);
+		if ((relative >= 0) and (relative < 4)) {
+			bits |= entry.rows[relative];
+		}
+		if (bits == FULL_ROW) {
+			cleared++;
+		}
+		else {
+			board[height++] = bits;
+		}
+	}
+
+	int aggregate_height = 0;
+	int holes = 0;
+	int bumpiness = 0;
+	int previous_height = -1;
+	for (int x = 0; x < BOARD_WIDTH; x++) {
+		int column_height = 0;
+		for (int row = height - 1; row >= 0; row--) {
+			if (board[row] & (1 << x)) {
+				if (column_height == 0) {
+					column_height = row + 1;
+				}
+			}
+			else if (column_height != 0) {
+				holes++;
+			}
+		}
+		aggregate_height += column_height;
+		if (previous_height >= 0) {
+			bumpiness += std::abs(column_height - previous_height);
+		}
+		previous_height = column_height;
+	}
+	return -0.51 * aggregate_height + 0.76 * cleared - 0.36 * holes - 0.18 * bumpiness;
+}
+
+inline Placement planPlacement(const Game& game) {
+	/* Best rotation and column for the current shape, dropping straight down from where it is */
+	const Shape& shape = game.getCurrentShape();
+	const CollisionTable& table = collisionTable();
+	int piece = static_cast<int>(shape.getPieceType());
+	absolutecoords position = shape.getPosition();
+	uint16_t rows[OCCUPANCY_ROWS];
+	boardRows(game, rows);
+
+	Placement best{ shape.getRotation(), position.x };
+	double best_score = -1e9;
+	for (int rotation = 0; rotation < (int)shape.getRotations().size(); rotation++) {
+		for (int column = 0; column < COLLISION_X_RANGE; column++) {
+			const CollisionEntry& entry = table.entries[piece][rotation][column];
+			if (!placementFits(rows, entry, position.y)) {
+				continue;
+			}
+			int y = position.y;
+			while (placementFits(rows, entry, y - 1)) {
+				y--;
+			}
+			double score = scorePlacement(rows, entry, y);
+			if (score > best_score) {
+				best_score = score;
+				best = Placement{ rotation, COLLISION_MIN_X + column };
+			}
+		}
+	}
+	return best;
+}
+
+inline Action actionTowards(const Game& game, const Placement& target) {
+	/* Rotate, then move, then slam */
+	const Shape& shape = game.getCurrentShape();
+	if ((shape.getRotation() != target.rotation) and game.checkShapeRotate(CLOCKWISE)) {
+		return Action::ROTATE_CLOCKWISE;
+	}
+	if ((shape.getPosition().x < target.x) and game.checkShapeMove(RIGHT)) {
+		return Action::RIGHT;
+	}
+	if ((shape.getPosition().x > target.x) and game.checkShapeMove(LEFT)) {
+		return Action::LEFT;
+	}
+	return Action::SLAM;
+}
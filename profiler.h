@@ -0,0 +1,169 @@
+#pragma once
+
+/* Lightweight hot-path profiler.
+
+   Build with -DTETRIS_PROFILE to enable. Otherwise every macro below expands to nothing and the profiler costs
+   nothing at runtime.
+
+   PROFILE_SCOPE(name)          time the enclosing scope, name must be a string literal
+   PROFILE_COUNT(counter, n)    add n to one of the per-frame counters
+   PROFILE_END_FRAME()          record the per-frame counters and reset them, call once per swap
+   PROFILE_DUMP(path)           write the ring buffers to path as Chrome trace-event JSON
+
+   Timings go into a fixed-size ring buffer, so only the most recent events are kept and nothing is allocated
+   while the game is running. Each thread records into a ring of its own, allocated the first time it records,
+   so the tools that run the engine on many threads can be profiled too; events are written with the number of
+   the thread they came from as the trace's tid. Dump once the other threads have stopped recording, their rings
+   are read without a lock. Load the dumped file in chrome://tracing or https://ui.perfetto.dev.
+*/
+
+#ifdef TETRIS_PROFILE
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <vector>
+#include <stdint.h>
+
+namespace profiler {
+
+// Counters reset at the end of each frame
+enum Counter { DRAW_CALLS, CUBES_DRAWN, GLYPHS_STROKED, NUM_COUNTERS };
+
+const char* const counter_names[NUM_COUNTERS] = { "draw calls", "cubes drawn", "glyphs stroked" };
+
+struct Event {
+	const char* name;
+	int64_t start_ns;
+	int64_t duration_ns;	// A negative duration marks a frame counter sample rather than a timed scope
+	int counters[NUM_COUNTERS];
+};
+
+// Must be a power of two
+const size_t RING_SIZE = 1 << 16;
+
+// One thread's events and counters
+struct State {
+	Event events[RING_SIZE];
+	size_t next = 0;			// Total number of events ever recorded
+	int counters[NUM_COUNTERS] = {};
+	int tid = 0;
+};
+
+// Every thread's state, kept until exit so a thread's events can be dumped after it has finished
+struct Registry {
+	std::mutex mutex;
+	std::vector<std::unique_ptr<State>> threads;
+	std::chrono::steady_clock::time_point epoch = std::chrono::steady_clock::now();
+};
+
+inline Registry& registry() {
+	static Registry r;
+	return r;
+}
+
+inline State& state() {
+	thread_local State* s = nullptr;
+	if (s == nullptr) {
+		Registry& r = registry();
+		std::lock_guard<std::mutex> lock(r.mutex);
+		r.threads.emplace_back(new State());
+		s = r.threads.back().get();
+		s->tid = (int)r.threads.size();
+	}
+	return *s;
+}
+
+inline int64_t now_ns() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - registry().epoch).count();
+}
+
+inline Event& push() {
+	State& s = state();
+	return s.events[s.next++ & (RING_SIZE - 1)];
+}
+
+class ScopedTimer {
+	/* Records the time between construction and destruction as one event */
+private:
+	const char* name;
+	int64_t start;
+
+public:
+	explicit ScopedTimer(const char* name) : name(name), start(now_ns()) {}
+
+	~ScopedTimer() {
+		Event& event = push();
+		event.name = name;
+		event.start_ns = start;
+		event.duration_ns = now_ns() - start;
+	}
+};
+
+inline void end_frame() {
+	/* Store this frame's counters as an event and start counting the next frame from zero */
+	State& s = state();
+	Event& event = push();
+	event.name = "frame";
+	event.start_ns = now_ns();
+	event.duration_ns = -1;
+	for (int i = 0; i < NUM_COUNTERS; i++) {
+		event.counters[i] = s.counters[i];
+		s.counters[i] = 0;
+	}
+}
+
+inline bool dump(const char* path) {
+	/* Write the events still held in every thread's ring buffer as Chrome trace-event JSON. Returns false on
+	   failure.
+	*/
+	Registry& r = registry();
+	std::lock_guard<std::mutex> lock(r.mutex);
+	FILE* file = std::fopen(path, "w");
+	if (file == nullptr) {
+		return false;
+	}
+
+	const char* separator = "";
+	std::fprintf(file, "{\"traceEvents\":[");
+	for (const std::unique_ptr<State>& s : r.threads) {
+		size_t first = (s->next > RING_SIZE) ? s->next - RING_SIZE : 0;
+		for (size_t i = first; i < s->next; i++) {
+			const Event& event = s->events[i & (RING_SIZE - 1)];
+			if (event.duration_ns >= 0) {
+				std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f}",
+					separator, event.name, s->tid, event.start_ns / 1000.0, event.duration_ns / 1000.0);
+			}
+			else {
+				std::fprintf(file, "%s\n{\"name\":\"%s\",\"ph\":\"C\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"args\":{",
+					separator, event.name, s->tid, event.start_ns / 1000.0);
+				for (int c = 0; c < NUM_COUNTERS; c++) {
+					std::fprintf(file, "%s\"%s\":%d", (c == 0) ? "" : ",", counter_names[c], event.counters[c]);
+				}
+				std::fprintf(file, "}}");
+			}
+			separator = ",";
+		}
+	}
+	std::fprintf(file, "\n]}\n");
+	return std::fclose(file) == 0;
+}
+
+} // namespace profiler
+
+#define PROFILE_CONCAT_INNER(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_INNER(a, b)
+#define PROFILE_SCOPE(name) profiler::ScopedTimer PROFILE_CONCAT(profile_scope_, __LINE__)(name)
+#define PROFILE_COUNT(counter, n) (profiler::state().counters[profiler::counter] += (n))
+#define PROFILE_END_FRAME() profiler::end_frame()
+#define PROFILE_DUMP(path) profiler::dump(path)
+
+#else
+
+#define PROFILE_SCOPE(name) ((void)0)
+#define PROFILE_COUNT(counter, n) ((void)0)
+#define PROFILE_END_FRAME() ((void)0)
+#define PROFILE_DUMP(path) ((void)0)
+
+#endif
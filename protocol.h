@@ -0,0 +1,196 @@
+#pragma once
+
+/* Binary protocol between tetris_server and its clients.
+
+   Every message is framed as
+       uint16 length   number of bytes that follow (type and body)
+       uint8  type
+       body
+   with all integers little-endian. A connection can host any number of game sessions, and the messages that
+   act on a session carry its id.
+
+   Client to server:
+       CREATE   uint32 tag, uint64 seed          start a game, the reply echoes the tag
+       ACTION   uint32 session, uint8 action     the same actions keyboard() handles, see Action in engine.h
+       RESTART  uint32 session, uint64 seed      replace the session's game with a new one
+       CLOSE    uint32 session                   end the session
+       SPECTATE   uint32 session                 follow a session's spectator stream, from any connection
+       UNSPECTATE uint32 session                 stop following it
+
+   Server to client:
+       CREATED  uint32 tag, uint32 session
+       STATE    uint32 session, then the session's state (see encodeState), sent at most once per server tick
+                and only for sessions that changed
+       ERROR    uint32 session, uint8 code       the session doesn't exist or belongs to another connection. Spectators
+                                                 get UNKNOWN_SESSION when a session they follow is closed.
+       KEYFRAME uint32 session, uint32 sequence, then the session's state as in STATE
+       DELTA    uint32 session, uint32 sequence, then the changes since the previous message in the stream
+                (see spectator.h)
+*/
+
+#include <string>
+#include <string.h>
+#include <stdint.h>
+
+#include "engine.h"
+
+enum class ClientMessage : uint8_t { CREATE = 1, ACTION = 2, RESTART = 3, CLOSE = 4, SPECTATE = 5, UNSPECTATE = 6 };
+enum class ServerMessage : uint8_t { CREATED = 1, STATE = 2, ERROR = 3, KEYFRAME = 4, DELTA = 5 };
+
+enum class ErrorCode : uint8_t { UNKNOWN_SESSION = 1, BAD_MESSAGE = 2 };
+
+// Size of the frame header, and the largest body a frame can carry
+const size_t FRAME_HEADER_SIZE = 3;
+const size_t MAX_FRAME_BODY = 65535 - 1;
+
+// Bytes in an encoded board: two 4-bit cells per byte, row by row from the bottom
+const size_t BOARD_BYTES = (BOARD_WIDTH * BOARD_HEIGHT) / 2;
+
+// Size of the body of a STATE message
+const size_t STATE_BODY_SIZE = 4 + 4 + 4 + 4 + 2 + 7 + BOARD_BYTES;
+
+class MessageWriter {
+	/* Appends framed messages to a buffer */
+private:
+	std::string& out;
+	size_t frame_start = 0;
+
+public:
+	explicit MessageWriter(std::string& out) : out(out) {}
+
+	MessageWriter& begin(uint8_t type) {
+		frame_start = out.size();
+		out.append(2, '\0');
+		return u8(type);
+	}
+
+	void end() {
+		size_t length = out.size() - frame_start - 2;
+		out[frame_start] = (char)(length & 0xFF);
+		out[frame_start + 1] = (char)(length >> 8);
+	}
+
+	MessageWriter& u8(uint8_t value) {
+		out.push_back((char)value);
+		return *this;
+	}
+
+	MessageWriter& u16(uint16_t value) {
+		return u8(value & 0xFF).u8(value >> 8);
+	}
+
+	MessageWriter& u32(uint32_t value) {
+		return u16(value & 0xFFFF).u16(value >> 16);
+	}
+
+	MessageWriter& u64(uint64_t value) {
+		return u32(value & 0xFFFFFFFF).u32(value >> 32);
+	}
+
+	MessageWriter& bytes(const uint8_t* data, size_t length) {
+		out.append((const char*)data, length);
+		return *this;
+	}
+};
+
+class MessageReader {
+	/* Reads the fields of one message body. Reading past the end sets failed and returns zeros. */
+private:
+	const uint8_t* data;
+	size_t length;
+	size_t position = 0;
+
+public:
+	bool failed = false;
+
+	MessageReader(const uint8_t* data, size_t length) : data(data), length(length) {}
+
+	uint8_t u8() {
+		if (position >= length) {
+			failed = true;
+			return 0;
+		}
+		return data[position++];
+	}
+
+	uint16_t u16() {
+		uint16_t low = u8();
+		return low | (uint16_t)(u8() << 8);
+	}
+
+	uint32_t u32() {
+		uint32_t low = u16();
+		return low | ((uint32_t)u16() << 16);
+	}
+
+	uint64_t u64() {
+		uint64_t low = u32();
+		return low | ((uint64_t)u32() << 32);
+	}
+
+	size_t size() const {
+		return length;
+	}
+
+	const uint8_t* bytes(size_t count) {
+		if (position + count > length) {
+			failed = true;
+			position = length;
+			return nullptr;
+		}
+		const uint8_t* start = data + position;
+		position += count;
+		return start;
+	}
+};
+
+inline bool nextFrame(const std::string& buffer, size_t& offset, uint8_t& type, MessageReader& body) {
+	/* Find the frame starting at offset. If a whole frame is there, returns true with its type and body and moves
+	   offset past it, otherwise returns false and leaves offset alone.
+	*/
+	if (buffer.size() - offset < FRAME_HEADER_SIZE) {
+		return false;
+	}
+	const uint8_t* start = (const uint8_t*)buffer.data() + offset;
+	size_t length = start[0] | (start[1] << 8);
+	if ((length == 0) or (buffer.size() - offset - 2 < length)) {
+		return false;
+	}
+	type = start[2];
+	body = MessageReader(start + FRAME_HEADER_SIZE, length - 1);
+	offset += 2 + length;
+	return true;
+}
+
+inline void encodeState(MessageWriter& writer, const Game& game) {
+	/* The state shared by STATE and KEYFRAME messages:
+	       uint32 ticks, int32 score, uint32 rows cleared, uint16 level,
+	       uint8 flags (1 = game over), uint8 piece, uint8 rotation, int8 x, int8 y, uint8 next piece, uint8 reserved,
+	       board (BOARD_BYTES)
+	*/
+	const Shape& shape = game.getCurrentShape();
+	absolutecoords position = shape.getPosition();
+	writer.u32(game.getTicks()).u32((uint32_t)game.getScore()).u32(game.getRowsCleared())
+		.u16(game.getLevel())
+		.u8(game.isGameOver() ? 1 : 0)
+		.u8(static_cast<uint8_t>(shape.getPieceType()))
+		.u8(shape.getRotation())
+		.u8((uint8_t)position.x)
+		.u8((uint8_t)position.y)
+		.u8(static_cast<uint8_t>(game.getNextShape().getPieceType()))
+		.u8(0);
+
+	uint8_t board[BOARD_BYTES];
+	for (int i = 0; i < BOARD_WIDTH * BOARD_HEIGHT; i += 2) {
+		int x = i % BOARD_WIDTH;
+		int y = i / BOARD_WIDTH;
+		board[i / 2] = (uint8_t)(static_cast<int>(game.getTile(x, y)) | (static_cast<int>(game.getTile(x + 1, y)) << 4));
+	}
+	writer.bytes(board, sizeof(board));
+}
+
+inline void encodeState(MessageWriter& writer, uint32_t session, const Game& game) {
+	/* Body of a STATE message: uint32 session, then the state */
+	writer.u32(session);
+	encodeState(writer, game);
+}
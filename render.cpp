@@ -0,0 +1,182 @@
+#include "render.h"
+
+#include <string>
+#include <string.h>
+
+const Colour TILE_PALETTE[NUM_TILE_STATES] = {
+	{ 0.0f, 0.0f, 0.0f },	// EMPTY
+	{ 1.0f, 0.0f, 0.0f },	// RED
+	{ 0.0f, 1.0f, 0.0f },	// GREEN
+	{ 0.0f, 0.0f, 1.0f },	// BLUE
+	{ 1.0f, 0.0f, 1.0f },	// PURPLE
+	{ 0.0f, 1.0f, 1.0f },	// CYAN
+	{ 1.0f, 1.0f, 0.0f },	// YELLOW
+	{ 1.0f, 0.6f, 0.6f },	// PINK
+	{ 0.5f, 0.5f, 0.5f },	// GARBAGE
+};
+
+const Colour BACKGROUND_COLOUR = { 0.0f, 0.8f, 1.0f };
+
+const Colour TEXT_COLOUR = { 0.0f, 0.0f, 0.0f };
+
+const float LIGHT_POSITIONS[2][4] = { { 1.0, 1.0, 2.0, 0.0 }, { -2.0, 0.0, 2.0, 0.0 } };
+const float LIGHT_AMBIENT[4] = { 0.1, 0.1, 0.1, 1.0 };
+const float LIGHT_DIFFUSE[4] = { 0.5, 0.5, 0.5, 1.0 };
+const float MATERIAL_AMBIENT[4] = { 0.05, 0.05, 0.05, 1.0 };
+const float MATERIAL_DIFFUSE[4] = { 0.75, 0.75, 0.75, 1.0 };
+const float MATERIAL_SPECULAR[4] = { 1.0, 1.0, 1.0, 1.0 };
+const float MATERIAL_SHININESS = 50.0;
+const float GLOBAL_AMBIENT = 0.2f;
+const float LIGHT_SPECULAR[2] = { 1.0f, 0.0f };
+
+void setColour(Canvas& canvas, TileState colour) {
+	/* Function to set the canvas to the given colour */
+	if (colour != TileState::EMPTY) {
+		canvas.setTileColour(colour);
+	}
+}
+
+void draw_text(Canvas& canvas, const char* text, int scale_factor)
+{
+	/* Draw text at current location - scaled by scale_factor */
+	const float scale = 0.005f * scale_factor;
+
+	canvas.pushMatrix();
+	canvas.scale(scale, scale, 1.0f);
+	size_t len = strlen(text);
+	for (size_t i = 0;i < len;i++)
+		canvas.strokeCharacter(text[i]);
+	canvas.popMatrix();
+}
+
+void draw_board3d(Canvas& canvas) {
+	/* Draws the lines that make up the 3d board */
+	canvas.setColour(TEXT_COLOUR);
+
+	//Bottom
+	const float bottom[4][3] = {
+		{ -0.25f, -0.25f, 0.25f },
+		{ -0.25f, -0.25f, -0.25f },
+		{ 4.75f, -0.25f, -0.25f },
+		{ 4.75f, -0.25f, 0.25f },
+	};
+	canvas.lineLoop(bottom, 4);
+
+	//Side
+	const float side[4][3] = {
+		{ -0.25f, 9.75f, -0.25f },
+		{ -0.25f, 9.75f, 0.25f },
+		{ -0.25f, -0.25f, 0.25f },
+		{ -0.25f, -0.25f, -0.25f },
+	};
+	canvas.lineLoop(side, 4);
+
+	//Back
+	const float back[4][3] = {
+		{ -0.25f, -0.25f, -0.25f },
+		{ -0.25f, 9.75f, -0.25f },
+		{ 4.75f, 9.75f, -0.25f },
+		{ 4.75f, -0.25f, -0.25f },
+	};
+	canvas.lineLoop(back, 4);
+}
+
+void draw_shape3d(Canvas& canvas, const Shape& shape) {
+	/* Draw the shape on the board */
+	setColour(canvas, shape.getColour());
+	absolutecoords grid_position = shape.getPosition();
+	canvas.pushMatrix();
+
+	// Move to the shape's absolute reference point
+	canvas.translate(grid_position.x * 0.5, grid_position.y * 0.5, 0.0f);
+	for (auto tile : shape.currentTiles()) {
+		canvas.pushMatrix();
+		// Move from the reference point to the exact location of this tile
+		canvas.translate(tile.relx * 0.5, tile.rely * 0.5, 0.0f);
+		canvas.solidCube(0.5f);
+		canvas.popMatrix();
+	}
+	canvas.popMatrix();
+}
+
+void draw_lookahead3d(Canvas& canvas, const Shape& shape) {
+	/* Draw the shape as a lookahead */
+	setColour(canvas, shape.getColour());
+	for (auto tile : shape.currentTiles()) {
+		canvas.pushMatrix();
+		canvas.translate((tile.relx * 0.5) + shape.getLookAheadXAdjust(), (tile.rely * 0.5) + shape.getLookAheadYAdjust(), 0.0f);
+		canvas.solidCube(0.5f);
+		canvas.popMatrix();
+	}
+}
+
+void draw_game3d(Canvas& canvas, const Game& game) {
+	/* Method for drawing the game */
+	PROFILE_SCOPE("Game::draw3d");
+
+	// Draw the board, add a cube of the correct colour wherever the board is not empty.
+	for (int x = 0; x < 10; x++) {
+		for (int y = 0; y < 20; y++) {
+			if (game.getTile(x, y) != TileState::EMPTY) {
+				canvas.pushMatrix();
+				canvas.translate(x * 0.5, y * 0.5, 0.0f);
+				setColour(canvas, game.getTile(x, y));
+				canvas.solidCube(0.5);
+				canvas.popMatrix();
+			}
+		}
+	}
+
+	// Draw the currentshape and the lookahead
+	draw_shape3d(canvas, game.getCurrentShape());
+
+	canvas.pushMatrix();
+	canvas.translate(7.5, 7, 0);
+	draw_lookahead3d(canvas, game.getNextShape());
+	canvas.translate(-1.5, 1.5, 0);
+	canvas.setColour(TEXT_COLOUR);
+	draw_text(canvas, "Next Piece");
+	canvas.popMatrix();
+
+	// Add the level and score texts
+	canvas.pushMatrix();
+	canvas.translate(6.5, 3.0, 0.0);
+	canvas.setColour(TEXT_COLOUR);
+	std::string text = "Level: " + std::to_string(game.getLevel());
+	draw_text(canvas, text.c_str());
+	canvas.translate(0.0, -1, 0.0);
+	text = "Score: " + std::to_string(game.getScore());
+	draw_text(canvas, text.c_str());
+
+	canvas.popMatrix();
+}
+
+void draw_scene(Canvas& canvas, const Game& game, bool flat_perspective) {
+	/* Draw the whole view of the game from the chosen camera */
+	if (flat_perspective) {
+		canvas.lookAt(5.0f, 5.0f, 20.0f, // eye position
+			5, 5.0f, 0.0f, // reference point
+			0, 1, 0  // up vector
+		);
+	}
+	else {
+		canvas.lookAt(15.0f, 5.0f, 15.0f, // eye position
+			5, 5.0f, 0.0f, // reference point
+			0, 1, 0  // up vector
+		);
+	}
+	canvas.setLighting(false);
+	draw_board3d(canvas);
+
+	canvas.setLighting(true);
+	draw_game3d(canvas, game);
+
+	if (game.isGameOver()) {
+		// Show game over text
+		canvas.pushMatrix();
+		canvas.translate(1.2f, 5.0f, 0.5f);
+		canvas.setColour(TEXT_COLOUR);
+		draw_text(canvas, "GAME OVER", 2);
+		canvas.popMatrix();
+	}
+}
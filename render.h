@@ -0,0 +1,97 @@
+#pragma once
+
+/* Drawing the game.
+
+   The scene is drawn through the Canvas interface rather than calling OpenGL directly, so the same drawing code
+   is used by the window (an OpenGL canvas in Tetris.cpp) and by the software renderer in softraster.h that
+   renders replays without a display.
+*/
+
+#include "engine.h"
+
+struct Colour {
+	float r;
+	float g;
+	float b;
+};
+
+// Colour of each tile, indexed by TileState. EMPTY is never drawn.
+extern const Colour TILE_PALETTE[NUM_TILE_STATES];
+
+// Colour the window is cleared to, and the colour of the board lines and text
+extern const Colour BACKGROUND_COLOUR;
+extern const Colour TEXT_COLOUR;
+
+// Lighting and material used for the cubes. init_lights() and init_material() hand these to OpenGL.
+// The lights are directional and given in eye coordinates.
+extern const float LIGHT_POSITIONS[2][4];
+extern const float LIGHT_AMBIENT[4];
+extern const float LIGHT_DIFFUSE[4];
+extern const float MATERIAL_AMBIENT[4];
+extern const float MATERIAL_DIFFUSE[4];
+extern const float MATERIAL_SPECULAR[4];
+extern const float MATERIAL_SHININESS;
+
+// OpenGL defaults that init_lights() leaves alone: the global ambient light, and LIGHT0 is the only light with a
+// white specular component. The software renderer and the lighting shader (gllighting.h) use them too.
+extern const float GLOBAL_AMBIENT;
+extern const float LIGHT_SPECULAR[2];
+
+// Normal that lines and stroked text are lit with while lighting is on, facing out of the plane text is drawn in
+const float LINE_NORMAL[3] = { 0.0f, 0.0f, 1.0f };
+
+// Vertical field of view and depth range of the camera
+const float CAMERA_FOV_Y = 40.0f;
+const float CAMERA_NEAR = 1.0f;
+const float CAMERA_FAR = 50.0f;
+
+class Canvas {
+	/* The drawing operations the game is made of, modelled on the fixed-function OpenGL calls it started with */
+public:
+	virtual ~Canvas() {}
+
+	// Replace the modelview matrix with a camera at eye looking at centre
+	virtual void lookAt(float eye_x, float eye_y, float eye_z, float centre_x, float centre_y, float centre_z, float up_x, float up_y, float up_z) = 0;
+
+	virtual void pushMatrix() = 0;
+	virtual void popMatrix() = 0;
+	virtual void translate(float x, float y, float z) = 0;
+	virtual void scale(float x, float y, float z) = 0;
+
+	virtual void setColour(Colour colour) = 0;
+
+	// Set the colour to a tile's colour in TILE_PALETTE. Canvases that keep the palette themselves override this.
+	virtual void setTileColour(TileState tile) {
+		setColour(TILE_PALETTE[static_cast<int>(tile)]);
+	}
+	virtual void setLighting(bool enabled) = 0;
+
+	// Draw a cube centred on the current origin
+	virtual void solidCube(float size) = 0;
+
+	// Draw a closed loop of lines through the given vertices
+	virtual void lineLoop(const float vertices[][3], int count) = 0;
+
+	// Draw one character of the stroke font and move the origin past it, like glutStrokeCharacter
+	virtual void strokeCharacter(char character) = 0;
+};
+
+void setColour(Canvas& canvas, TileState colour);
+
+// Draw text at current location - scaled by scale_factor
+void draw_text(Canvas& canvas, const char* text, int scale_factor = 1);
+
+// Draws the lines that make up the 3d board
+void draw_board3d(Canvas& canvas);
+
+// Draw a shape at its position on the board
+void draw_shape3d(Canvas& canvas, const Shape& shape);
+
+// Draw a shape as a lookahead, relative to the current origin
+void draw_lookahead3d(Canvas& canvas, const Shape& shape);
+
+// Draw the board, the falling and next shapes, and the level and score
+void draw_game3d(Canvas& canvas, const Game& game);
+
+// Draw everything display() shows: camera, board, game and game over text
+void draw_scene(Canvas& canvas, const Game& game, bool flat_perspective);
@@ -0,0 +1,162 @@
+/* Renders stored replays to image sequences without a window, display or GPU.
+
+   Usage: render_replays [options] replay...
+     --out DIR        directory to write frames to (default: current directory)
+     --size N         width and height of each frame in pixels (default: 512, the window size)
+     --flat           use the flat camera instead of the isometric one
+     --format F       ppm (raw) or png (default: png)
+     --step N         render a frame every N ticks (default: 1, one frame per 50ms of game time)
+     --threads N      number of replays to render at once (default: one per core)
+
+   Frames are written as DIR/<replay name>_<frame number>.<format>. Each replay is rendered on one thread, and
+   replays are shared out between threads.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "render.h"
+#include "softraster.h"
+
+struct RenderOptions {
+	std::string out_dir = ".";
+	int size = 512;
+	bool flat_perspective = false;
+	bool png = true;
+	uint32_t step = 1;
+	unsigned int threads = 0;
+};
+
+static std::string baseName(const std::string& path) {
+	/* File name without its directory or extension */
+	size_t start = path.find_last_of('/');
+	start = (start == std::string::npos) ? 0 : start + 1;
+	size_t end = path.find_last_of('.');
+	if ((end == std::string::npos) or (end < start)) {
+		end = path.size();
+	}
+	return path.substr(start, end - start);
+}
+
+static bool renderReplay(const std::string& path, const RenderOptions& options, int& frames_written) {
+	/* Play the replay back tick by tick, writing a frame every options.step ticks and one at the end */
+	Replay replay;
+	if (!loadReplay(replay, path.c_str())) {
+		fprintf(stderr, "Could not read replay %s\n", path.c_str());
+		return false;
+	}
+
+	Game game(replay.seed);
+	SoftwareCanvas canvas(options.size, options.size);
+	std::string prefix = options.out_dir + "/" + baseName(path) + "_";
+	const char* extension = options.png ? ".png" : ".ppm";
+	size_t next_event = 0;
+	frames_written = 0;
+
+	for (uint32_t tick = 0; ; tick++) {
+		// Actions are taken between ticks, in the order they were recorded
+		while ((next_event < replay.events.size()) and (replay.events[next_event].tick == tick)) {
+			game.apply(replay.events[next_event].action);
+			next_event++;
+		}
+
+		bool finished = game.isGameOver() or (tick >= replay.end_tick);
+		if (((tick % options.step) == 0) or finished) {
+			canvas.clear(BACKGROUND_COLOUR);
+			draw_scene(canvas, game, options.flat_perspective);
+
+			char number[16];
+			snprintf(number, sizeof(number), "%06d", frames_written);
+			std::string frame_path = prefix + number + extension;
+			bool written = options.png
+				? writePNG(frame_path.c_str(), canvas.getWidth(), canvas.getHeight(), canvas.pixels())
+				: writePPM(frame_path.c_str(), canvas.getWidth(), canvas.getHeight(), canvas.pixels());
+			if (!written) {
+				fprintf(stderr, "Could not write %s\n", frame_path.c_str());
+				return false;
+			}
+			frames_written++;
+		}
+
+		if (finished) {
+			return true;
+		}
+		game.tick();
+	}
+}
+
+int main(int argc, char* argv[]) {
+	RenderOptions options;
+	std::vector<std::string> replays;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--out") and has_value) {
+			options.out_dir = argv[++i];
+		}
+		else if ((arg == "--size") and has_value) {
+			options.size = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--flat") {
+			options.flat_perspective = true;
+		}
+		else if ((arg == "--format") and has_value) {
+			options.png = (strcmp(argv[++i], "ppm") != 0);
+		}
+		else if ((arg == "--step") and has_value) {
+			options.step = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--threads") and has_value) {
+			options.threads = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg.compare(0, 2, "--") == 0) {
+			fprintf(stderr, "Unknown option %s\n", arg.c_str());
+			return 2;
+		}
+		else {
+			replays.push_back(arg);
+		}
+	}
+
+	if (replays.empty()) {
+		fprintf(stderr, "Usage: %s [--out DIR] [--size N] [--flat] [--format png|ppm] [--step N] [--threads N] replay...\n", argv[0]);
+		return 2;
+	}
+
+	unsigned int num_threads = options.threads;
+	if (num_threads == 0) {
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+	num_threads = std::min<unsigned int>(num_threads, replays.size());
+
+	// Each thread takes the next replay nobody has started yet
+	std::atomic<size_t> next_replay(0);
+	std::atomic<int> failures(0);
+	std::atomic<long> total_frames(0);
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < num_threads; t++) {
+		workers.emplace_back([&] {
+			for (size_t i = next_replay++; i < replays.size(); i = next_replay++) {
+				int frames = 0;
+				if (!renderReplay(replays[i], options, frames)) {
+					failures++;
+				}
+				total_frames += frames;
+			}
+		});
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	printf("Rendered %ld frames from %zu replays\n", total_frames.load(), replays.size());
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,337 @@
+/* Generates training data by playing seeded games without a window, on every core.
+
+   Usage: tetris_selfplay [options]
+     --out DIR            directory to write shards to (default: current directory)
+     --samples N          stop once this many samples have been written, finishing the games being played
+                          (default: 1000000)
+     --seed N             seed of the first game, game i uses seed + i (default: 1)
+     --threads N          number of games to play at once (default: one per core)
+     --shard-records N    records per shard file before starting the next (default: 1048576)
+     --epsilon F          chance of a random action instead of the planned one (default: 0.05)
+
+   Games are played by the greedy placement policy in planner.h: when a piece appears it picks the rotation and column that leave
+   the best board, then rotates, moves and slams it there one action per tick. A sample is written for every
+   action, holding the state the action was taken in and the score it earned up to the next action.
+
+   Each thread writes its own shards, DIR/selfplay_<thread>_<shard number>.bin, straight into a shared memory
+   mapping, so nothing is buffered or allocated per sample. A shard is a header of SHARD_HEADER_SIZE bytes followed
+   by records of RECORD_SIZE bytes, all little-endian:
+
+   Header
+       0   char[4] "TRDS"
+       4   uint32  version (1)
+       8   uint32  record size
+       12  uint32  header size, the offset of the first record
+       16  uint64  records written, kept up to date after every game so a shard cut short is still readable
+       24  uint64  seed of the first game in the shard
+       32  uint64  seed of the last game in the shard
+       40  uint32  games that ended in the shard
+       44  uint32  thread
+       48  uint32  shard number, counting up per thread
+       52  uint32  1 once the shard is finished, 0 while it is being written
+   Record
+       0   uint64  seed of the game
+       8   uint32  tick the action was taken on
+       12  int32   reward: the score gained from this action to the next one
+       16  uint8   piece, rotation, then int8 x, y of the current shape
+       20  uint8   next piece
+       21  uint8   action (see Action in engine.h)
+       22  uint8   rows cleared by the reward
+       23  uint8   flags (1 = the game ended before the next action)
+       24  uint16  level
+       26  uint8[25] board: the 20 rows bit-packed as 10-bit rows from the bottom, bit x of a row is column x
+       51          zero padding up to RECORD_SIZE
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "planner.h"
+
+const size_t RECORD_SIZE = 64;
+const size_t SHARD_HEADER_SIZE = 4096;
+const uint32_t SHARD_VERSION = 1;
+
+// Bytes taken by a board packed as 10-bit rows
+const size_t PACKED_BOARD_BYTES = (BOARD_WIDTH * BOARD_HEIGHT + 7) / 8;
+
+const uint8_t SAMPLE_GAME_OVER = 1;
+
+struct SelfPlayOptions {
+	std::string out_dir = ".";
+	uint64_t samples = 1000000;
+	uint64_t seed = 1;
+	unsigned int threads = 0;
+	uint64_t shard_records = 1 << 20;
+	double epsilon = 0.05;
+};
+
+static void put16(uint8_t* out, uint16_t value) {
+	out[0] = value & 0xFF;
+	out[1] = value >> 8;
+}
+
+static void put32(uint8_t* out, uint32_t value) {
+	put16(out, value & 0xFFFF);
+	put16(out + 2, value >> 16);
+}
+
+static void put64(uint8_t* out, uint64_t value) {
+	put32(out, value & 0xFFFFFFFF);
+	put32(out + 4, value >> 32);
+}
+
+class ShardWriter {
+	/* Hands out record slots in a memory-mapped shard file, starting a new shard when one fills up */
+private:
+	const SelfPlayOptions& options;
+	unsigned int thread;
+	uint32_t shard_number = 0;
+	int fd = -1;
+	uint8_t* map = nullptr;
+	size_t map_size = 0;
+	uint64_t records = 0;
+	uint32_t games = 0;
+	bool has_game = false;
+
+	bool open() {
+		char name[64];
+		snprintf(name, sizeof(name), "/selfplay_%02u_%05u.bin", thread, shard_number);
+		std::string path = options.out_dir + name;
+		fd = ::open(path.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0644);
+		map_size = SHARD_HEADER_SIZE + options.shard_records * RECORD_SIZE;
+		if ((fd < 0) or (ftruncate(fd, map_size) < 0)) {
+			perror(path.c_str());
+			return false;
+		}
+		void* mapped = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+		if (mapped == MAP_FAILED) {
+			perror("mmap");
+			return false;
+		}
+		map = (uint8_t*)mapped;
+		madvise(map, map_size, MADV_SEQUENTIAL);
+
+		memcpy(map, "TRDS", 4);
+		put32(map + 4, SHARD_VERSION);
+		put32(map + 8, RECORD_SIZE);
+		put32(map + 12, SHARD_HEADER_SIZE);
+		put32(map + 44, thread);
+		put32(map + 48, shard_number);
+		records = 0;
+		games = 0;
+		has_game = false;
+		return true;
+	}
+
+	void close() {
+		/* Mark the shard finished and cut the file down to the records written */
+		if (map == nullptr) {
+			return;
+		}
+		put64(map + 16, records);
+		put32(map + 40, games);
+		put32(map + 52, 1);
+		munmap(map, map_size);
+		map = nullptr;
+		if (ftruncate(fd, SHARD_HEADER_SIZE + records * RECORD_SIZE) < 0) {
+			perror("ftruncate");
+		}
+		::close(fd);
+		fd = -1;
+		shard_number++;
+	}
+
+public:
+	ShardWriter(const SelfPlayOptions& options, unsigned int thread) : options(options), thread(thread) {}
+
+	~ShardWriter() {
+		close();
+	}
+
+	uint8_t* next(uint64_t seed) {
+		/* Slot for the next record of the game with the given seed, or null if the shard can't be written */
+		if ((map != nullptr) and (records == options.shard_records)) {
+			close();
+		}
+		if ((map == nullptr) and !open()) {
+			return nullptr;
+		}
+		if (!has_game) {
+			put64(map + 24, seed);
+			has_game = true;
+		}
+		put64(map + 32, seed);
+		return map + SHARD_HEADER_SIZE + RECORD_SIZE * records++;
+	}
+
+	void gameEnded() {
+		if (map != nullptr) {
+			games++;
+			put64(map + 16, records);
+			put32(map + 40, games);
+		}
+	}
+};
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+static void packBoard(const Game& game, uint8_t out[PACKED_BOARD_BYTES]) {
+	memset(out, 0, PACKED_BOARD_BYTES);
+	for (int y = 0; y < BOARD_HEIGHT; y++) {
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			if (game.getTile(x, y) != TileState::EMPTY) {
+				int bit = y * BOARD_WIDTH + x;
+				out[bit / 8] |= 1 << (bit % 8);
+			}
+		}
+	}
+}
+
+static void writeSample(uint8_t* record, uint64_t seed, const Game& game, Action action) {
+	/* Fill in everything but the reward, which is only known at the next action */
+	const Shape& shape = game.getCurrentShape();
+	absolutecoords position = shape.getPosition();
+	memset(record, 0, RECORD_SIZE);
+	put64(record, seed);
+	put32(record + 8, game.getTicks());
+	record[16] = static_cast<uint8_t>(shape.getPieceType());
+	record[17] = shape.getRotation();
+	record[18] = (uint8_t)position.x;
+	record[19] = (uint8_t)position.y;
+	record[20] = static_cast<uint8_t>(game.getNextShape().getPieceType());
+	record[21] = static_cast<uint8_t>(action);
+	put16(record + 24, game.getLevel());
+	packBoard(game, record + 26);
+}
+
+static void finishSample(uint8_t* record, const Game& game, int score_before, int rows_before) {
+	put32(record + 12, (uint32_t)(game.getScore() - score_before));
+	record[22] = (uint8_t)(game.getRowsCleared() - rows_before);
+	if (game.isGameOver()) {
+		record[23] |= SAMPLE_GAME_OVER;
+	}
+}
+
+static void playGames(const SelfPlayOptions& options, unsigned int thread, std::atomic<uint64_t>& next_game, std::atomic<uint64_t>& samples) {
+	ShardWriter writer(options, thread);
+	PieceRandom exploration(options.seed ^ (0x9E3779B97F4A7C15ULL * (thread + 1)));
+	int epsilon_threshold = (int)(std::min(1.0, std::max(0.0, options.epsilon)) * 1e9);
+
+	while (samples < options.samples) {
+		uint64_t seed = options.seed + next_game++;
+		Game game(seed);
+		uint32_t planned_piece = UINT32_MAX;
+		Placement target{ 0, 0 };
+		bool slammed = false;
+
+		// The record of the last action, finished when the next one is taken or the game ends
+		uint8_t* pending = nullptr;
+		int score_before = 0;
+		int rows_before = 0;
+		uint64_t game_samples = 0;
+
+		while (!game.isGameOver()) {
+			if (game.getPiecesPlaced() != planned_piece) {
+				planned_piece = game.getPiecesPlaced();
+				target = planPlacement(game);
+				slammed = false;
+			}
+
+			if (!slammed) {
+				Action action = Action::SLAM;
+				if (exploration.nextBelow(1000000000) < epsilon_threshold) {
+					action = static_cast<Action>(exploration.nextBelow(NUM_ACTIONS));
+				}
+				else {
+					action = actionTowards(game, target);
+				}
+				slammed = (action == Action::SLAM);
+
+				if (pending != nullptr) {
+					finishSample(pending, game, score_before, rows_before);
+				}
+				pending = writer.next(seed);
+				if (pending == nullptr) {
+					return;
+				}
+				writeSample(pending, seed, game, action);
+				score_before = game.getScore();
+				rows_before = game.getRowsCleared();
+				game_samples++;
+				game.apply(action);
+			}
+			game.tick();
+		}
+
+		if (pending != nullptr) {
+			finishSample(pending, game, score_before, rows_before);
+		}
+		writer.gameEnded();
+		// Counted per game rather than per sample so threads don't contend on the total
+		samples += game_samples;
+	}
+}
+
+int main(int argc, char* argv[]) {
+	SelfPlayOptions options;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--out") and has_value) {
+			options.out_dir = argv[++i];
+		}
+		else if ((arg == "--samples") and has_value) {
+			options.samples = strtoull(argv[++i], nullptr, 10);
+		}
+		else if ((arg == "--seed") and has_value) {
+			options.seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if ((arg == "--threads") and has_value) {
+			options.threads = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--shard-records") and has_value) {
+			options.shard_records = std::max(1ULL, strtoull(argv[++i], nullptr, 10));
+		}
+		else if ((arg == "--epsilon") and has_value) {
+			options.epsilon = atof(argv[++i]);
+		}
+		else {
+			fprintf(stderr, "Usage: %s [--out DIR] [--samples N] [--seed N] [--threads N] [--shard-records N] [--epsilon F]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	unsigned int num_threads = options.threads;
+	if (num_threads == 0) {
+		num_threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	std::atomic<uint64_t> next_game(0);
+	std::atomic<uint64_t> samples(0);
+	std::vector<std::thread> workers;
+	for (unsigned int t = 0; t < num_threads; t++) {
+		workers.emplace_back([&, t] {
+			playGames(options, t, next_game, samples);
+		});
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+
+	printf("Wrote %llu samples from %llu games\n", (unsigned long long)samples.load(), (unsigned long long)next_game.load());
+	return 0;
+}
@@ -0,0 +1,763 @@
+/* Hosts many games in one process behind a local socket.
+
+   Usage: tetris_server [--unix PATH] [--tcp PORT] [--threads N]
+     --unix PATH      listen on a Unix socket (default: /tmp/tetris.sock)
+     --tcp PORT       also listen on TCP on localhost
+     --threads N      number of game threads (default: one per core)
+
+   Clients speak the protocol in protocol.h. Games are split between game threads (shards) by session id. Each
+   shard owns its games outright and runs their gravity ticks from a timer wheel, so no locks are taken on a game.
+   The network thread only moves bytes: it routes incoming actions to the owning shard's inbox, and each shard
+   hands back all of the state updates from one tick as a single batch per connection.
+
+   Any connection can also spectate a session. The shard owning the session encodes its spectator stream (see
+   spectator.h) once per tick and the network thread queues that one buffer on every spectator's connection.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <csignal>
+#include <deque>
+#include <cstdio>
+#include <cstdlib>
+#include <mutex>
+#include <string>
+#include <string.h>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "protocol.h"
+#include "spectator.h"
+
+// Time between ticks of a game, as glutTimerFunc uses in Tetris.cpp
+const uint64_t TICK_MS = 50;
+
+// Output a connection can have queued before it is dropped for not keeping up
+const size_t MAX_QUEUED_BYTES = 16 << 20;
+
+typedef std::chrono::steady_clock server_clock;
+
+class TimerWheel {
+	/* Hashed timer wheel with one-millisecond slots. A timer is stored in the slot for its due time, modulo the
+	   number of slots, so scheduling is constant time and each millisecond only looks at one slot.
+	*/
+private:
+	static const uint64_t SLOTS = 128;
+
+	struct Timer {
+		uint32_t session;
+		uint64_t due_ms;
+	};
+
+	std::vector<Timer> slots[SLOTS];
+	std::vector<Timer> expired;
+	uint64_t current_ms = 0;
+
+public:
+	explicit TimerWheel(uint64_t start_ms) : current_ms(start_ms) {}
+
+	void schedule(uint32_t session, uint64_t due_ms) {
+		due_ms = std::max(due_ms, current_ms + 1);
+		slots[due_ms % SLOTS].push_back(Timer{ session, due_ms });
+	}
+
+	template <typename Callback>
+	void advance(uint64_t now_ms, Callback on_expired) {
+		/* Run every timer due up to now_ms, calling on_expired(session, due_ms). Timers a full turn or more away
+		   stay in their slot.
+		*/
+		while (current_ms < now_ms) {
+			current_ms++;
+			std::vector<Timer>& slot = slots[current_ms % SLOTS];
+			expired.clear();
+			size_t kept = 0;
+			for (size_t i = 0; i < slot.size(); i++) {
+				if (slot[i].due_ms <= current_ms) {
+					expired.push_back(slot[i]);
+				}
+				else {
+					slot[kept++] = slot[i];
+				}
+			}
+			slot.resize(kept);
+			for (const Timer& timer : expired) {
+				on_expired(timer.session, timer.due_ms);
+			}
+		}
+	}
+};
+
+struct Command {
+	/* Work for a shard, queued by the network thread */
+	enum Type { CREATE, ACTION, RESTART, CLOSE, SUBSCRIBE, UNSUBSCRIBE } type;
+	uint32_t session;
+	uint32_t connection;
+	uint32_t tag;
+	uint64_t seed;
+	Action action;
+};
+
+struct Session {
+	Game game;
+	uint32_t connection;
+	StatePublisher publisher;
+	std::vector<uint32_t> spectators;	// Connections following the session's spectator stream
+	bool dirty = false;
+	bool scheduled = false;
+};
+
+class Server;
+
+class Shard {
+	/* A game thread and the sessions it owns */
+private:
+	Server& server;
+	std::mutex inbox_mutex;
+	std::vector<Command> inbox;
+	std::vector<Command> working;
+
+	std::unordered_map<uint32_t, Session> sessions;
+	std::vector<uint32_t> dirty;
+	TimerWheel wheel;
+
+	// Outgoing bytes for this tick, per connection, and spectator frames to queue as they are
+	std::unordered_map<uint32_t, std::string> batch;
+	std::vector<std::pair<uint32_t, SharedFrame>> frames;
+
+	void markDirty(uint32_t id, Session& session) {
+		if (!session.dirty) {
+			session.dirty = true;
+			dirty.push_back(id);
+		}
+	}
+
+	void schedule(uint32_t id, Session& session, uint64_t due_ms) {
+		if (!session.scheduled) {
+			session.scheduled = true;
+			wheel.schedule(id, due_ms);
+		}
+	}
+
+	void spectate(uint32_t id, Session& session, uint32_t connection);
+	void handle(const Command& command, uint64_t now_ms);
+	void tick(uint64_t now_ms);
+
+public:
+	Shard(Server& server, uint64_t start_ms) : server(server), wheel(start_ms) {}
+
+	void post(const Command& command) {
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		inbox.push_back(command);
+	}
+
+	void run();
+};
+
+class Server {
+	/* Owns the shards and the network thread */
+private:
+	struct Connection {
+		int fd;
+		std::string in;
+		std::deque<SharedFrame> out;	// Sent in order, the front one from out_offset
+		size_t out_offset = 0;
+		size_t out_bytes = 0;
+		std::vector<uint32_t> sessions;
+		std::vector<uint32_t> watching;
+	};
+
+	std::vector<int> listeners;
+	int wake_pipe[2];
+	std::unordered_map<uint32_t, Connection> connections;
+	uint32_t next_connection = 1;
+	uint32_t next_session = 1;
+
+	// Which connection owns each session, only touched by the network thread
+	std::unordered_map<uint32_t, uint32_t> owners;
+
+	std::mutex outbound_mutex;
+	std::vector<std::pair<uint32_t, SharedFrame>> outbound;
+
+	std::vector<Shard*> shards;
+	std::vector<std::thread> threads;
+
+	Shard& shardFor(uint32_t session) {
+		return *shards[session % shards.size()];
+	}
+
+	void accept(int listener);
+	void readFrom(uint32_t id, Connection& connection);
+	void handleMessage(uint32_t id, Connection& connection, uint8_t type, MessageReader& body);
+	void queue(Connection& connection, const SharedFrame& frame);
+	void sendError(Connection& connection, uint32_t session, ErrorCode code);
+	bool flush(Connection& connection);
+	void drop(uint32_t id);
+	void collectOutbound();
+
+public:
+	std::atomic<bool> running{ true };
+	const server_clock::time_point start = server_clock::now();
+
+	uint64_t nowMs() const {
+		return std::chrono::duration_cast<std::chrono::milliseconds>(server_clock::now() - start).count();
+	}
+
+	bool listenUnix(const char* path);
+	bool listenTcp(int port);
+	void startShards(unsigned int count);
+	void run();
+
+	void deliver(std::unordered_map<uint32_t, std::string>& batch, std::vector<std::pair<uint32_t, SharedFrame>>& frames) {
+		/* Called by a shard with everything it produced in one tick */
+		{
+			std::lock_guard<std::mutex> lock(outbound_mutex);
+			for (auto& entry : batch) {
+				if (!entry.second.empty()) {
+					outbound.emplace_back(entry.first, std::make_shared<const std::string>(std::move(entry.second)));
+				}
+			}
+			outbound.insert(outbound.end(), frames.begin(), frames.end());
+		}
+		batch.clear();
+		frames.clear();
+		char wake = 1;
+		ssize_t written = write(wake_pipe[1], &wake, 1);
+		(void)written;
+	}
+};
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+void Shard::spectate(uint32_t id, Session& session, uint32_t connection) {
+	/* Add a spectator and send it enough of the stream to be up to date */
+	if (std::find(session.spectators.begin(), session.spectators.end(), connection) != session.spectators.end()) {
+		return;
+	}
+	session.spectators.push_back(connection);
+	if (session.spectators.size() == 1) {
+		// Nobody was watching, so nothing has been published since the game last changed
+		session.publisher.reset();
+		frames.emplace_back(connection, session.publisher.publish(id, session.game));
+		return;
+	}
+	for (const SharedFrame& frame : session.publisher.catchUp()) {
+		frames.emplace_back(connection, frame);
+	}
+}
+
+void Shard::handle(const Command& command, uint64_t now_ms) {
+	if (command.type == Command::CREATE) {
+		Session& session = sessions[command.session];
+		session.game = Game(command.seed);
+		session.connection = command.connection;
+		MessageWriter writer(batch[command.connection]);
+		writer.begin((uint8_t)ServerMessage::CREATED).u32(command.tag).u32(command.session).end();
+		markDirty(command.session, session);
+		schedule(command.session, session, now_ms + TICK_MS);
+		return;
+	}
+
+	auto found = sessions.find(command.session);
+	if (found == sessions.end()) {
+		return;
+	}
+	Session& session = found->second;
+	switch (command.type) {
+	case Command::ACTION:
+		session.game.apply(command.action);
+		markDirty(command.session, session);
+		break;
+	case Command::RESTART:
+		session.game = Game(command.seed);
+		session.publisher.reset();
+		markDirty(command.session, session);
+		schedule(command.session, session, now_ms + TICK_MS);
+		break;
+	case Command::CLOSE:
+		// Any timer still in the wheel finds the session gone and is dropped
+		for (uint32_t spectator : session.spectators) {
+			MessageWriter writer(batch[spectator]);
+			writer.begin((uint8_t)ServerMessage::ERROR).u32(command.session).u8((uint8_t)ErrorCode::UNKNOWN_SESSION).end();
+		}
+		sessions.erase(found);
+		break;
+	case Command::SUBSCRIBE:
+		spectate(command.session, session, command.connection);
+		break;
+	case Command::UNSUBSCRIBE:
+		session.spectators.erase(std::remove(session.spectators.begin(), session.spectators.end(), command.connection), session.spectators.end());
+		break;
+	default:
+		break;
+	}
+}
+
+void Shard::tick(uint64_t now_ms) {
+	{
+		std::lock_guard<std::mutex> lock(inbox_mutex);
+		working.swap(inbox);
+	}
+	for (const Command& command : working) {
+		handle(command, now_ms);
+	}
+	working.clear();
+
+	wheel.advance(now_ms, [&](uint32_t id, uint64_t due_ms) {
+		auto found = sessions.find(id);
+		if (found == sessions.end()) {
+			return;
+		}
+		Session& session = found->second;
+		session.scheduled = false;
+		if (session.game.tick()) {
+			markDirty(id, session);
+		}
+		// Finished games stop ticking until they are restarted
+		if (!session.game.isGameOver()) {
+			schedule(id, session, due_ms + TICK_MS);
+		}
+	});
+
+	for (uint32_t id : dirty) {
+		auto found = sessions.find(id);
+		if (found == sessions.end()) {
+			continue;
+		}
+		Session& session = found->second;
+		session.dirty = false;
+		MessageWriter writer(batch[session.connection]);
+		writer.begin((uint8_t)ServerMessage::STATE);
+		encodeState(writer, id, session.game);
+		writer.end();
+
+		if (!session.spectators.empty()) {
+			SharedFrame frame = session.publisher.publish(id, session.game);
+			if (frame) {
+				for (uint32_t spectator : session.spectators) {
+					frames.emplace_back(spectator, frame);
+				}
+			}
+		}
+	}
+	dirty.clear();
+
+	if (!batch.empty() or !frames.empty()) {
+		server.deliver(batch, frames);
+	}
+}
+
+void Shard::run() {
+	uint64_t now_ms = server.nowMs();
+	while (server.running) {
+		tick(now_ms);
+		now_ms++;
+		std::this_thread::sleep_until(server.start + std::chrono::milliseconds(now_ms));
+		now_ms = std::max(now_ms, server.nowMs());
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+static bool setNonBlocking(int fd) {
+	int flags = fcntl(fd, F_GETFL, 0);
+	return (flags != -1) and (fcntl(fd, F_SETFL, flags | O_NONBLOCK) != -1);
+}
+
+bool Server::listenUnix(const char* path) {
+	int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+	unlink(path);
+	if ((bind(fd, (sockaddr*)&address, sizeof(address)) < 0) or (listen(fd, 128) < 0) or !setNonBlocking(fd)) {
+		close(fd);
+		return false;
+	}
+	listeners.push_back(fd);
+	return true;
+}
+
+bool Server::listenTcp(int port) {
+	int fd = socket(AF_INET, SOCK_STREAM, 0);
+	if (fd < 0) {
+		return false;
+	}
+	int enable = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &enable, sizeof(enable));
+	sockaddr_in address{};
+	address.sin_family = AF_INET;
+	address.sin_port = htons(port);
+	address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if ((bind(fd, (sockaddr*)&address, sizeof(address)) < 0) or (listen(fd, 128) < 0) or !setNonBlocking(fd)) {
+		close(fd);
+		return false;
+	}
+	listeners.push_back(fd);
+	return true;
+}
+
+void Server::startShards(unsigned int count) {
+	if (pipe(wake_pipe) < 0) {
+		perror("pipe");
+		exit(1);
+	}
+	setNonBlocking(wake_pipe[0]);
+	setNonBlocking(wake_pipe[1]);
+
+	uint64_t now_ms = nowMs();
+	for (unsigned int i = 0; i < count; i++) {
+		shards.push_back(new Shard(*this, now_ms));
+	}
+	for (Shard* shard : shards) {
+		threads.emplace_back([shard] { shard->run(); });
+	}
+}
+
+void Server::accept(int listener) {
+	while (true) {
+		int fd = ::accept(listener, nullptr, nullptr);
+		if (fd < 0) {
+			return;
+		}
+		setNonBlocking(fd);
+		int enable = 1;
+		setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &enable, sizeof(enable));
+		Connection& connection = connections[next_connection++];
+		connection.fd = fd;
+	}
+}
+
+void Server::queue(Connection& connection, const SharedFrame& frame) {
+	connection.out.push_back(frame);
+	connection.out_bytes += frame->size();
+}
+
+void Server::sendError(Connection& connection, uint32_t session, ErrorCode code) {
+	std::string out;
+	MessageWriter writer(out);
+	writer.begin((uint8_t)ServerMessage::ERROR).u32(session).u8((uint8_t)code).end();
+	queue(connection, std::make_shared<const std::string>(std::move(out)));
+}
+
+void Server::handleMessage(uint32_t id, Connection& connection, uint8_t type, MessageReader& body) {
+	Command command{};
+	command.connection = id;
+
+	switch ((ClientMessage)type) {
+	case ClientMessage::CREATE:
+		command.type = Command::CREATE;
+		command.tag = body.u32();
+		command.seed = body.u64();
+		if (body.failed) {
+			sendError(connection, 0, ErrorCode::BAD_MESSAGE);
+			return;
+		}
+		command.session = next_session++;
+		owners[command.session] = id;
+		connection.sessions.push_back(command.session);
+		shardFor(command.session).post(command);
+		return;
+	case ClientMessage::ACTION:
+		command.type = Command::ACTION;
+		command.session = body.u32();
+		command.action = (Action)body.u8();
+		if ((uint8_t)command.action >= NUM_ACTIONS) {
+			body.failed = true;
+		}
+		break;
+	case ClientMessage::RESTART:
+		command.type = Command::RESTART;
+		command.session = body.u32();
+		command.seed = body.u64();
+		break;
+	case ClientMessage::CLOSE:
+		command.type = Command::CLOSE;
+		command.session = body.u32();
+		break;
+	case ClientMessage::SPECTATE:
+	case ClientMessage::UNSPECTATE: {
+		// Spectating is open to every connection, so only check that the session exists
+		command.type = ((ClientMessage)type == ClientMessage::SPECTATE) ? Command::SUBSCRIBE : Command::UNSUBSCRIBE;
+		command.session = body.u32();
+		if (body.failed) {
+			break;
+		}
+		if (owners.find(command.session) == owners.end()) {
+			sendError(connection, command.session, ErrorCode::UNKNOWN_SESSION);
+			return;
+		}
+		auto watched = std::find(connection.watching.begin(), connection.watching.end(), command.session);
+		if (command.type == Command::SUBSCRIBE) {
+			if (watched == connection.watching.end()) {
+				connection.watching.push_back(command.session);
+			}
+		}
+		else if (watched != connection.watching.end()) {
+			connection.watching.erase(watched);
+		}
+		shardFor(command.session).post(command);
+		return;
+	}
+	default:
+		body.failed = true;
+	}
+
+	if (body.failed) {
+		sendError(connection, command.session, ErrorCode::BAD_MESSAGE);
+		return;
+	}
+	auto owner = owners.find(command.session);
+	if ((owner == owners.end()) or (owner->second != id)) {
+		sendError(connection, command.session, ErrorCode::UNKNOWN_SESSION);
+		return;
+	}
+	if (command.type == Command::CLOSE) {
+		owners.erase(owner);
+		connection.sessions.erase(std::remove(connection.sessions.begin(), connection.sessions.end(), command.session), connection.sessions.end());
+	}
+	shardFor(command.session).post(command);
+}
+
+void Server::readFrom(uint32_t id, Connection& connection) {
+	/* Read everything the socket has and handle the complete frames. A client that sends its last commands and
+	   closes still has them handled before the connection is dropped.
+	*/
+	char buffer[65536];
+	bool closed = false;
+	while (true) {
+		ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+		if (received > 0) {
+			connection.in.append(buffer, received);
+			continue;
+		}
+		if ((received < 0) and (errno == EINTR)) {
+			continue;
+		}
+		closed = (received == 0) or ((errno != EAGAIN) and (errno != EWOULDBLOCK));
+		break;
+	}
+
+	size_t offset = 0;
+	uint8_t type;
+	MessageReader body(nullptr, 0);
+	while (nextFrame(connection.in, offset, type, body)) {
+		handleMessage(id, connection, type, body);
+	}
+	connection.in.erase(0, offset);
+	if (closed) {
+		drop(id);
+	}
+}
+
+bool Server::flush(Connection& connection) {
+	/* Write as much pending output as the socket takes, straight from the queued frames. Returns false if the
+	   connection has failed.
+	*/
+	const size_t MAX_PARTS = 64;
+	iovec parts[MAX_PARTS];
+	while (!connection.out.empty()) {
+		size_t count = 0;
+		for (auto frame = connection.out.begin(); (frame != connection.out.end()) and (count < MAX_PARTS); ++frame) {
+			size_t skip = (count == 0) ? connection.out_offset : 0;
+			parts[count].iov_base = (void*)((*frame)->data() + skip);
+			parts[count].iov_len = (*frame)->size() - skip;
+			count++;
+		}
+
+		ssize_t sent = writev(connection.fd, parts, count);
+		if (sent < 0) {
+			if ((errno == EAGAIN) or (errno == EWOULDBLOCK) or (errno == EINTR)) {
+				break;
+			}
+			return false;
+		}
+		connection.out_bytes -= sent;
+		while (sent > 0) {
+			size_t remaining = connection.out.front()->size() - connection.out_offset;
+			if ((size_t)sent < remaining) {
+				connection.out_offset += sent;
+				break;
+			}
+			sent -= remaining;
+			connection.out.pop_front();
+			connection.out_offset = 0;
+		}
+	}
+	return true;
+}
+
+void Server::drop(uint32_t id) {
+	/* Close a connection and every session it owned */
+	auto found = connections.find(id);
+	if (found == connections.end()) {
+		return;
+	}
+	for (uint32_t session : found->second.sessions) {
+		owners.erase(session);
+		Command command{};
+		command.type = Command::CLOSE;
+		command.session = session;
+		command.connection = id;
+		shardFor(session).post(command);
+	}
+	for (uint32_t session : found->second.watching) {
+		Command command{};
+		command.type = Command::UNSUBSCRIBE;
+		command.session = session;
+		command.connection = id;
+		shardFor(session).post(command);
+	}
+	close(found->second.fd);
+	connections.erase(found);
+}
+
+void Server::collectOutbound() {
+	std::vector<std::pair<uint32_t, SharedFrame>> pending;
+	{
+		std::lock_guard<std::mutex> lock(outbound_mutex);
+		pending.swap(outbound);
+	}
+	for (auto& entry : pending) {
+		auto found = connections.find(entry.first);
+		if (found != connections.end()) {
+			queue(found->second, entry.second);
+		}
+	}
+}
+
+void Server::run() {
+	std::vector<pollfd> fds;
+	std::vector<uint32_t> ids;
+	while (running) {
+		fds.clear();
+		ids.clear();
+		fds.push_back(pollfd{ wake_pipe[0], POLLIN, 0 });
+		for (int listener : listeners) {
+			fds.push_back(pollfd{ listener, POLLIN, 0 });
+		}
+		size_t first_connection = fds.size();
+		for (auto& entry : connections) {
+			short events = POLLIN | (entry.second.out.empty() ? 0 : POLLOUT);
+			fds.push_back(pollfd{ entry.second.fd, events, 0 });
+			ids.push_back(entry.first);
+		}
+
+		if (poll(fds.data(), fds.size(), 100) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("poll");
+			return;
+		}
+
+		if (fds[0].revents & POLLIN) {
+			char drain[256];
+			while (read(wake_pipe[0], drain, sizeof(drain)) > 0) {
+			}
+		}
+		for (size_t i = 1; i < first_connection; i++) {
+			if (fds[i].revents & POLLIN) {
+				accept(fds[i].fd);
+			}
+		}
+		for (size_t i = first_connection; i < fds.size(); i++) {
+			auto found = connections.find(ids[i - first_connection]);
+			if ((found != connections.end()) and (fds[i].revents & (POLLIN | POLLHUP | POLLERR))) {
+				readFrom(found->first, found->second);
+			}
+		}
+
+		// Queue this round's updates and errors, then write to every connection with something to send
+		collectOutbound();
+		std::vector<uint32_t> failed;
+		for (auto& entry : connections) {
+			if (!entry.second.out.empty() and (!flush(entry.second) or (entry.second.out_bytes > MAX_QUEUED_BYTES))) {
+				failed.push_back(entry.first);
+			}
+		}
+		for (uint32_t id : failed) {
+			drop(id);
+		}
+	}
+
+	for (std::thread& thread : threads) {
+		thread.join();
+	}
+	for (Shard* shard : shards) {
+		delete shard;
+	}
+	for (auto& entry : connections) {
+		close(entry.second.fd);
+	}
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+Server* running_server = nullptr;
+
+void stop(int) {
+	running_server->running = false;
+}
+
+int main(int argc, char* argv[]) {
+	const char* unix_path = "/tmp/tetris.sock";
+	int tcp_port = 0;
+	unsigned int num_threads = std::max(1u, std::thread::hardware_concurrency());
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--unix") and has_value) {
+			unix_path = argv[++i];
+		}
+		else if ((arg == "--tcp") and has_value) {
+			tcp_port = atoi(argv[++i]);
+		}
+		else if ((arg == "--threads") and has_value) {
+			num_threads = std::max(1, atoi(argv[++i]));
+		}
+		else {
+			fprintf(stderr, "Usage: %s [--unix PATH] [--tcp PORT] [--threads N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	signal(SIGPIPE, SIG_IGN);
+	Server server;
+	running_server = &server;
+	signal(SIGINT, stop);
+	signal(SIGTERM, stop);
+
+	if (!server.listenUnix(unix_path)) {
+		perror(unix_path);
+		return 1;
+	}
+	if ((tcp_port != 0) and !server.listenTcp(tcp_port)) {
+		perror("tcp");
+		return 1;
+	}
+
+	server.startShards(num_threads);
+	printf("Listening on %s%s with %u game threads\n", unix_path, (tcp_port != 0) ? " and TCP" : "", num_threads);
+	fflush(stdout);
+	server.run();
+	unlink(unix_path);
+	return 0;
+}
@@ -0,0 +1,301 @@
+/* Load-testing client for tetris_server.
+
+   Usage: tetris_client [--unix PATH | --tcp PORT] [--sessions N] [--connections N] [--seconds N] [--actions N]
+                        [--spectators N] [--watch N]
+     --unix PATH        server's Unix socket (default: /tmp/tetris.sock)
+     --tcp PORT         connect over TCP to localhost instead
+     --sessions N       games to create (default: 10000)
+     --connections N    connections to spread them over (default: 16)
+     --seconds N        how long to play for once every game is created (default: 10)
+     --actions N        random actions per game per second (default: 2)
+     --spectators N     extra connections that only watch games (default: 0)
+     --watch N          games each spectator follows, the first N created (default: 1)
+
+   Games that end are restarted with a new seed. At the end it prints how many actions were sent and how many
+   state updates came back, and how much of the spectator streams each spectator received.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <random>
+#include <string>
+#include <string.h>
+#include <unordered_map>
+#include <vector>
+
+#include <arpa/inet.h>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "protocol.h"
+#include "spectator.h"
+
+typedef std::chrono::steady_clock client_clock;
+
+struct ClientConnection {
+	int fd;
+	std::string in;
+	std::string out;
+	std::vector<uint32_t> sessions;
+	std::unordered_map<uint32_t, SpectatorView> views;	// Games this connection spectates
+};
+
+struct ClientStats {
+	uint64_t created = 0;
+	uint64_t states = 0;
+	uint64_t errors = 0;
+	uint64_t actions = 0;
+	uint64_t restarts = 0;
+	uint64_t bytes_received = 0;
+	uint64_t keyframes = 0;
+	uint64_t deltas = 0;
+	uint64_t stream_bytes = 0;
+};
+
+static int connectTo(const char* unix_path, int tcp_port) {
+	int fd;
+	if (tcp_port != 0) {
+		fd = socket(AF_INET, SOCK_STREAM, 0);
+		sockaddr_in address{};
+		address.sin_family = AF_INET;
+		address.sin_port = htons(tcp_port);
+		address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+		if ((fd < 0) or (connect(fd, (sockaddr*)&address, sizeof(address)) < 0)) {
+			return -1;
+		}
+	}
+	else {
+		fd = socket(AF_UNIX, SOCK_STREAM, 0);
+		sockaddr_un address{};
+		address.sun_family = AF_UNIX;
+		strncpy(address.sun_path, unix_path, sizeof(address.sun_path) - 1);
+		if ((fd < 0) or (connect(fd, (sockaddr*)&address, sizeof(address)) < 0)) {
+			return -1;
+		}
+	}
+	fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	return fd;
+}
+
+static bool pump(ClientConnection& connection, ClientStats& stats, std::mt19937_64& random) {
+	/* Send what is queued and handle what has arrived. Returns false if the connection failed. */
+	while (!connection.out.empty()) {
+		ssize_t sent = send(connection.fd, connection.out.data(), connection.out.size(), 0);
+		if (sent > 0) {
+			connection.out.erase(0, sent);
+		}
+		else if ((errno == EAGAIN) or (errno == EWOULDBLOCK) or (errno == EINTR)) {
+			break;
+		}
+		else {
+			return false;
+		}
+	}
+
+	char buffer[65536];
+	while (true) {
+		ssize_t received = recv(connection.fd, buffer, sizeof(buffer), 0);
+		if (received > 0) {
+			connection.in.append(buffer, received);
+			stats.bytes_received += received;
+		}
+		else if ((received < 0) and ((errno == EAGAIN) or (errno == EWOULDBLOCK) or (errno == EINTR))) {
+			break;
+		}
+		else {
+			return false;
+		}
+	}
+
+	size_t offset = 0;
+	uint8_t type;
+	MessageReader body(nullptr, 0);
+	while (nextFrame(connection.in, offset, type, body)) {
+		switch ((ServerMessage)type) {
+		case ServerMessage::CREATED:
+			body.u32();
+			connection.sessions.push_back(body.u32());
+			stats.created++;
+			break;
+		case ServerMessage::STATE: {
+			uint32_t session = body.u32();
+			body.bytes(4 + 4 + 4 + 2);
+			bool game_over = (body.u8() & 1) != 0;
+			stats.states++;
+			if (game_over) {
+				MessageWriter writer(connection.out);
+				writer.begin((uint8_t)ClientMessage::RESTART).u32(session).u64(random()).end();
+				stats.restarts++;
+			}
+			break;
+		}
+		case ServerMessage::ERROR:
+			stats.errors++;
+			break;
+		case ServerMessage::KEYFRAME:
+		case ServerMessage::DELTA: {
+			SpectatorView& view = connection.views[body.u32()];
+			if (!view.apply(type, body)) {
+				stats.errors++;
+			}
+			if ((ServerMessage)type == ServerMessage::KEYFRAME) {
+				stats.keyframes++;
+			}
+			else {
+				stats.deltas++;
+			}
+			stats.stream_bytes += FRAME_HEADER_SIZE + 4 + body.size();
+			break;
+		}
+		}
+	}
+	connection.in.erase(0, offset);
+	return true;
+}
+
+int main(int argc, char* argv[]) {
+	const char* unix_path = "/tmp/tetris.sock";
+	int tcp_port = 0;
+	int num_sessions = 10000;
+	int num_connections = 16;
+	double seconds = 10;
+	double actions_per_second = 2;
+	int num_spectators = 0;
+	int num_watched = 1;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--unix") and has_value) {
+			unix_path = argv[++i];
+		}
+		else if ((arg == "--tcp") and has_value) {
+			tcp_port = atoi(argv[++i]);
+		}
+		else if ((arg == "--sessions") and has_value) {
+			num_sessions = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--connections") and has_value) {
+			num_connections = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--seconds") and has_value) {
+			seconds = atof(argv[++i]);
+		}
+		else if ((arg == "--actions") and has_value) {
+			actions_per_second = atof(argv[++i]);
+		}
+		else if ((arg == "--spectators") and has_value) {
+			num_spectators = std::max(0, atoi(argv[++i]));
+		}
+		else if ((arg == "--watch") and has_value) {
+			num_watched = std::max(1, atoi(argv[++i]));
+		}
+		else {
+			fprintf(stderr, "Usage: %s [--unix PATH | --tcp PORT] [--sessions N] [--connections N] [--seconds N] [--actions N] [--spectators N] [--watch N]\n", argv[0]);
+			return 2;
+		}
+	}
+
+	std::mt19937_64 random(12345);
+	// Players come first, spectators after them
+	std::vector<ClientConnection> connections(num_connections + num_spectators);
+	for (int i = 0; i < num_connections + num_spectators; i++) {
+		connections[i].fd = connectTo(unix_path, tcp_port);
+		if (connections[i].fd < 0) {
+			perror("connect");
+			return 1;
+		}
+	}
+	for (int i = 0; i < num_sessions; i++) {
+		MessageWriter writer(connections[i % num_connections].out);
+		writer.begin((uint8_t)ClientMessage::CREATE).u32(i).u64(random()).end();
+	}
+
+	ClientStats stats;
+	client_clock::time_point start = client_clock::now();
+	client_clock::time_point play_start;
+	bool playing = false;
+	double action_credit = 0;
+	client_clock::time_point last_round = start;
+
+	std::vector<pollfd> fds(connections.size());
+	while (true) {
+		for (size_t i = 0; i < connections.size(); i++) {
+			fds[i] = pollfd{ connections[i].fd, (short)(POLLIN | (connections[i].out.empty() ? 0 : POLLOUT)), 0 };
+		}
+		poll(fds.data(), fds.size(), 5);
+		for (ClientConnection& connection : connections) {
+			if (!pump(connection, stats, random)) {
+				fprintf(stderr, "Lost connection to server\n");
+				return 1;
+			}
+		}
+
+		client_clock::time_point now = client_clock::now();
+		if (!playing) {
+			if (stats.created == (uint64_t)num_sessions) {
+				printf("Created %d sessions in %.3f s\n", num_sessions, std::chrono::duration<double>(now - start).count());
+				playing = true;
+				play_start = now;
+				last_round = now;
+				stats.states = 0;
+				stats.bytes_received = 0;
+
+				const std::vector<uint32_t>& watched = connections[0].sessions;
+				for (int i = num_connections; i < num_connections + num_spectators; i++) {
+					MessageWriter writer(connections[i].out);
+					for (int j = 0; (j < num_watched) and (j < (int)watched.size()); j++) {
+						writer.begin((uint8_t)ClientMessage::SPECTATE).u32(watched[j]).end();
+					}
+				}
+			}
+			continue;
+		}
+
+		// Send this round's share of random actions to random sessions
+		action_credit += std::chrono::duration<double>(now - last_round).count() * actions_per_second * num_sessions;
+		last_round = now;
+		while (action_credit >= 1) {
+			ClientConnection& connection = connections[random() % num_connections];
+			if (!connection.sessions.empty()) {
+				uint32_t session = connection.sessions[random() % connection.sessions.size()];
+				MessageWriter writer(connection.out);
+				writer.begin((uint8_t)ClientMessage::ACTION).u32(session).u8(random() % NUM_ACTIONS).end();
+				stats.actions++;
+			}
+			action_credit -= 1;
+		}
+
+		if (std::chrono::duration<double>(now - play_start).count() >= seconds) {
+			break;
+		}
+	}
+
+	double elapsed = std::chrono::duration<double>(client_clock::now() - play_start).count();
+	printf("Played %d sessions for %.1f s: %.0f actions/s sent, %.0f state updates/s received (%.1f MB/s), %llu restarts, %llu errors\n",
+		num_sessions, elapsed, stats.actions / elapsed, stats.states / elapsed, stats.bytes_received / elapsed / 1e6,
+		(unsigned long long)stats.restarts, (unsigned long long)stats.errors);
+	if (num_spectators > 0) {
+		uint64_t gaps = 0;
+		for (ClientConnection& connection : connections) {
+			for (auto& entry : connection.views) {
+				gaps += entry.second.gaps;
+			}
+		}
+		printf("%d spectators: %llu keyframes and %llu deltas received, %.0f bytes/s per spectator, %llu gaps\n",
+			num_spectators, (unsigned long long)stats.keyframes, (unsigned long long)stats.deltas,
+			stats.stream_bytes / elapsed / num_spectators, (unsigned long long)gaps);
+	}
+	for (ClientConnection& connection : connections) {
+		close(connection.fd);
+	}
+	return (stats.errors == 0) ? 0 : 1;
+}
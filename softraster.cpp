@@ -0,0 +1,523 @@
+#include "softraster.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <string.h>
+
+// Height of a capital letter in GLUT_STROKE_ROMAN units, and the stroke font below is drawn on a grid six cells
+// high, so each cell is this many units
+const float STROKE_CAP_HEIGHT = 100.0f;
+const float STROKE_CELL = STROKE_CAP_HEIGHT / 6;
+
+/* Stroke font for printable ASCII, starting at ' '.
+   Each glyph is a list of strokes separated by ';', each stroke a list of x,y points joined by lines. The grid is
+   0-4 wide with the baseline at y=0, capitals reaching y=6, lower case y=4 and descenders y=-2.
+*/
+const char* const STROKE_FONT[95] = {
+	"",											// space
+	"1,6 1,2; 1,1 1,0",							// !
+	"1,6 1,4; 3,6 3,4",							// "
+	"1,0 1,6; 3,0 3,6; 0,2 4,2; 0,4 4,4",		// #
+	"4,5 0,5 0,3 4,3 4,1 0,1; 2,6 2,0",			// $
+	"0,0 4,6; 0,6 0,5; 4,1 4,0",				// %
+	"4,0 0,4 1,6 2,5 0,2 0,0 2,0 4,2",			// &
+	"1,6 1,4",									// '
+	"2,6 1,4 1,2 2,0",							// (
+	"1,6 2,4 2,2 1,0",							// )
+	"2,5 2,1; 0,3 4,3; 1,4 3,2; 1,2 3,4",		// *
+	"2,5 2,1; 0,3 4,3",							// +
+	"1,1 1,0 0,-1",								// ,
+	"0,3 3,3",									// -
+	"1,1 1,0",									// .
+	"0,0 4,6",									// /
+	"0,0 4,0 4,6 0,6 0,0; 0,0 4,6",				// 0
+	"1,5 2,6 2,0; 1,0 3,0",						// 1
+	"0,6 4,6 4,3 0,3 0,0 4,0",					// 2
+	"0,6 4,6 4,0 0,0; 1,3 4,3",					// 3
+	"3,0 3,6 0,2 4,2",							// 4
+	"4,6 0,6 0,3 4,3 4,0 0,0",					// 5
+	"4,6 0,6 0,0 4,0 4,3 0,3",					// 6
+	"0,6 4,6 1,0",								// 7
+	"0,0 4,0 4,6 0,6 0,0; 0,3 4,3",				// 8
+	"4,3 0,3 0,6 4,6 4,0 0,0",					// 9
+	"1,4 1,3; 1,1 1,0",							// :
+	"1,4 1,3; 1,1 1,0 0,-1",					// ;
+	"4,6 0,3 4,0",								// <
+	"0,2 4,2; 0,4 4,4",							// =
+	"0,6 4,3 0,0",								// >
+	"0,5 1,6 4,6 4,3 2,3 2,2; 2,1 2,0",			// ?
+	"3,2 1,2 1,4 3,4 3,1 4,1 4,6 0,6 0,0 4,0",	// @
+	"0,0 2,6 4,0; 1,3 3,3",						// A
+	"0,0 0,6 3,6 4,5 4,4 3,3 0,3; 3,3 4,2 4,1 3,0 0,0",	// B
+	"4,6 0,6 0,0 4,0",							// C
+	"0,0 0,6 3,6 4,5 4,1 3,0 0,0",				// D
+	"4,6 0,6 0,0 4,0; 0,3 3,3",					// E
+	"4,6 0,6 0,0; 0,3 3,3",						// F
+	"4,6 0,6 0,0 4,0 4,3 2,3",					// G
+	"0,0 0,6; 4,0 4,6; 0,3 4,3",				// H
+	"1,6 3,6; 2,6 2,0; 1,0 3,0",				// I
+	"4,6 4,0 0,0 0,2",							// J
+	"0,0 0,6; 4,6 0,3 4,0",						// K
+	"0,6 0,0 4,0",								// L
+	"0,0 0,6 2,3 4,6 4,0",						// M
+	"0,0 0,6 4,0 4,6",							// N
+	"0,0 0,6 4,6 4,0 0,0",						// O
+	"0,0 0,6 4,6 4,3 0,3",						// P
+	"0,0 0,6 4,6 4,1 3,0 0,0; 2,2 4,0",			// Q
+	"0,0 0,6 4,6 4,3 0,3 4,0",					// R
+	"4,6 0,6 0,3 4,3 4,0 0,0",					// S
+	"0,6 4,6; 2,6 2,0",							// T
+	"0,6 0,0 4,0 4,6",							// U
+	"0,6 2,0 4,6",								// V
+	"0,6 1,0 2,3 3,0 4,6",						// W
+	"0,0 4,6; 0,6 4,0",							// X
+	"0,6 2,3 4,6; 2,3 2,0",						// Y
+	"0,6 4,6 0,0 4,0",							// Z
+	"2,6 1,6 1,0 2,0",							// [
+	"0,6 4,0",									// backslash
+	"1,6 2,6 2,0 1,0",							// ]
+	"0,4 2,6 4,4",								// ^
+	"0,-1 4,-1",								// _
+	"1,6 2,5",									// `
+	"0,4 3,4 3,0; 3,2 0,2 0,0 3,0",				// a
+	"0,6 0,0 3,0 3,4 0,4",						// b
+	"3,4 0,4 0,0 3,0",							// c
+	"3,6 3,0 0,0 0,4 3,4",						// d
+	"0,2 3,2 3,4 0,4 0,0 3,0",					// e
+	"3,6 1,6 1,0; 0,4 2,4",						// f
+	"3,4 0,4 0,1 3,1; 3,4 3,-2 0,-2",			// g
+	"0,6 0,0; 0,4 3,4 3,0",						// h
+	"1,4 1,0; 1,6 1,5",							// i
+	"2,4 2,-2 0,-2; 2,6 2,5",					// j
+	"0,6 0,0; 3,4 0,2 3,0",						// k
+	"1,6 1,0",									// l
+	"0,0 0,4 4,4 4,0; 2,4 2,0",					// m
+	"0,0 0,4 3,4 3,0",							// n
+	"0,0 0,4 3,4 3,0 0,0",						// o
+	"0,-2 0,4 3,4 3,0 0,0",						// p
+	"3,-2 3,4 0,4 0,0 3,0",						// q
+	"0,0 0,4; 0,3 1,4 3,4",						// r
+	"3,4 0,4 0,2 3,2 3,0 0,0",					// s
+	"1,6 1,0 3,0; 0,4 3,4",						// t
+	"0,4 0,0 3,0 3,4",							// u
+	"0,4 1.5,0 3,4",							// v
+	"0,4 1,0 2,3 3,0 4,4",						// w
+	"0,0 3,4; 0,4 3,0",							// x
+	"0,4 1.5,1; 3,4 0,-2",						// y
+	"0,4 3,4 0,0 3,0",							// z
+	"2,6 1,5 1,4 0,3 1,2 1,1 2,0",				// {
+	"1,6 1,-2",									// |
+	"1,6 2,5 2,4 3,3 2,2 2,1 1,0",				// }
+	"0,3 1,4 3,2 4,3",							// ~
+};
+
+struct StrokeGlyph {
+	std::vector<std::vector<std::array<float, 2>>> strokes;
+	float advance;
+};
+
+static std::vector<StrokeGlyph> parseStrokeFont() {
+	/* Turn the glyph strings above into lists of points, in GLUT stroke font units */
+	std::vector<StrokeGlyph> glyphs;
+	for (const char* definition : STROKE_FONT) {
+		StrokeGlyph glyph;
+		float glyph_width = 2.0f;
+		std::vector<std::array<float, 2>> stroke;
+		const char* p = definition;
+		while (*p != '\0') {
+			if (*p == ';') {
+				glyph.strokes.push_back(stroke);
+				stroke.clear();
+				p++;
+			}
+			else if (*p == ' ') {
+				p++;
+			}
+			else {
+				char* end;
+				float x = strtof(p, &end);
+				float y = strtof(end + 1, &end);
+				stroke.push_back({ x * STROKE_CELL, y * STROKE_CELL });
+				glyph_width = std::max(glyph_width, x);
+				p = end;
+			}
+		}
+		if (!stroke.empty()) {
+			glyph.strokes.push_back(stroke);
+		}
+		glyph.advance = (glyph_width + 2.0f) * STROKE_CELL;
+		glyphs.push_back(glyph);
+	}
+	return glyphs;
+}
+
+static const std::vector<StrokeGlyph>& strokeFont() {
+	static const std::vector<StrokeGlyph> glyphs = parseStrokeFont();
+	return glyphs;
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+static void normalise(float v[3]) {
+	float length = std::sqrt(v[0] * v[0] + v[1] * v[1] + v[2] * v[2]);
+	if (length > 0) {
+		v[0] /= length;
+		v[1] /= length;
+		v[2] /= length;
+	}
+}
+
+static float dot(const float a[3], const float b[3]) {
+	return a[0] * b[0] + a[1] * b[1] + a[2] * b[2];
+}
+
+SoftwareCanvas::SoftwareCanvas(int width, int height)
+	: width(width), height(height), colour_buffer(width * height * 3), depth_buffer(width * height) {
+	/* Set up the same projection as reshape(): gluPerspective with the aspect ratio of the image */
+	float aspect_ratio = (float)width / height;
+	float f = 1.0f / std::tan(CAMERA_FOV_Y * 3.14159265f / 360.0f);
+	projection = {};
+	projection[0][0] = f / aspect_ratio;
+	projection[1][1] = f;
+	projection[2][2] = (CAMERA_FAR + CAMERA_NEAR) / (CAMERA_NEAR - CAMERA_FAR);
+	projection[2][3] = (2 * CAMERA_FAR * CAMERA_NEAR) / (CAMERA_NEAR - CAMERA_FAR);
+	projection[3][2] = -1;
+
+	modelview = {};
+	for (int i = 0; i < 4; i++) {
+		modelview[i][i] = 1;
+	}
+	clear(BACKGROUND_COLOUR);
+}
+
+void SoftwareCanvas::clear(Colour background) {
+	for (int i = 0; i < width * height; i++) {
+		colour_buffer[i * 3 + 0] = (uint8_t)(background.r * 255 + 0.5f);
+		colour_buffer[i * 3 + 1] = (uint8_t)(background.g * 255 + 0.5f);
+		colour_buffer[i * 3 + 2] = (uint8_t)(background.b * 255 + 0.5f);
+	}
+	std::fill(depth_buffer.begin(), depth_buffer.end(), 1.0f);
+}
+
+void SoftwareCanvas::lookAt(float eye_x, float eye_y, float eye_z, float centre_x, float centre_y, float centre_z, float up_x, float up_y, float up_z) {
+	/* Same matrix as gluLookAt, replacing the modelview matrix */
+	float forward[3] = { centre_x - eye_x, centre_y - eye_y, centre_z - eye_z };
+	normalise(forward);
+	float up[3] = { up_x, up_y, up_z };
+	float side[3] = { forward[1] * up[2] - forward[2] * up[1], forward[2] * up[0] - forward[0] * up[2], forward[0] * up[1] - forward[1] * up[0] };
+	normalise(side);
+	float true_up[3] = { side[1] * forward[2] - side[2] * forward[1], side[2] * forward[0] - side[0] * forward[2], side[0] * forward[1] - side[1] * forward[0] };
+	float eye[3] = { eye_x, eye_y, eye_z };
+
+	modelview = {};
+	for (int i = 0; i < 3; i++) {
+		modelview[0][i] = side[i];
+		modelview[1][i] = true_up[i];
+		modelview[2][i] = -forward[i];
+	}
+	modelview[0][3] = -dot(side, eye);
+	modelview[1][3] = -dot(true_up, eye);
+	modelview[2][3] = dot(forward, eye);
+	modelview[3][3] = 1;
+}
+
+void SoftwareCanvas::pushMatrix() {
+	matrix_stack.push_back(modelview);
+}
+
+void SoftwareCanvas::popMatrix() {
+	if (!matrix_stack.empty()) {
+		modelview = matrix_stack.back();
+		matrix_stack.pop_back();
+	}
+}
+
+void SoftwareCanvas::translate(float x, float y, float z) {
+	for (int row = 0; row < 4; row++) {
+		modelview[row][3] += modelview[row][0] * x + modelview[row][1] * y + modelview[row][2] * z;
+	}
+}
+
+void SoftwareCanvas::scale(float x, float y, float z) {
+	for (int row = 0; row < 4; row++) {
+		modelview[row][0] *= x;
+		modelview[row][1] *= y;
+		modelview[row][2] *= z;
+	}
+}
+
+void SoftwareCanvas::setColour(Colour new_colour) {
+	colour = new_colour;
+}
+
+void SoftwareCanvas::setLighting(bool enabled) {
+	lighting = enabled;
+}
+
+SoftwareCanvas::ScreenVertex SoftwareCanvas::project(const float position[3]) const {
+	/* Transform a point from object coordinates to pixel coordinates and depth in [-1, 1] */
+	float eye[4];
+	for (int row = 0; row < 4; row++) {
+		eye[row] = modelview[row][0] * position[0] + modelview[row][1] * position[1] + modelview[row][2] * position[2] + modelview[row][3];
+	}
+	float clip[4];
+	for (int row = 0; row < 4; row++) {
+		clip[row] = projection[row][0] * eye[0] + projection[row][1] * eye[1] + projection[row][2] * eye[2] + projection[row][3] * eye[3];
+	}
+
+	ScreenVertex vertex;
+	vertex.visible = clip[3] > CAMERA_NEAR * 0.5f;
+	float w = vertex.visible ? clip[3] : 1.0f;
+	vertex.x = (clip[0] / w + 1.0f) * 0.5f * width;
+	vertex.y = (1.0f - clip[1] / w) * 0.5f * height;
+	vertex.z = clip[2] / w;
+	return vertex;
+}
+
+Colour SoftwareCanvas::lightFace(const float normal[3]) const {
+	/* Colour of a flat-shaded face with the given object space normal, as GL_COLOR_MATERIAL lighting gives it */
+	float eye_normal[3];
+	for (int row = 0; row < 3; row++) {
+		eye_normal[row] = modelview[row][0] * normal[0] + modelview[row][1] * normal[1] + modelview[row][2] * normal[2];
+	}
+	normalise(eye_normal);
+
+	float diffuse = GLOBAL_AMBIENT + 2 * LIGHT_AMBIENT[0];
+	float specular = 0.0f;
+	for (int i = 0; i < 2; i++) {
+		float light[3] = { LIGHT_POSITIONS[i][0], LIGHT_POSITIONS[i][1], LIGHT_POSITIONS[i][2] };
+		normalise(light);
+		float intensity = dot(eye_normal, light);
+		if (intensity > 0) {
+			diffuse += intensity * LIGHT_DIFFUSE[0];
+
+			// The viewer is at infinity (GL_LIGHT_MODEL_LOCAL_VIEWER is off), so the half vector uses (0, 0, 1)
+			float half[3] = { light[0], light[1], light[2] + 1.0f };
+			normalise(half);
+			float highlight = std::max(0.0f, dot(eye_normal, half));
+			specular += LIGHT_SPECULAR[i] * MATERIAL_SPECULAR[0] * std::pow(highlight, MATERIAL_SHININESS);
+		}
+	}
+
+	return Colour{
+		std::min(1.0f, colour.r * diffuse + specular),
+		std::min(1.0f, colour.g * diffuse + specular),
+		std::min(1.0f, colour.b * diffuse + specular),
+	};
+}
+
+void SoftwareCanvas::plot(int x, int y, float z, Colour fill) {
+	/* Write one pixel if it is on screen and nearer than what is already there */
+	if ((x < 0) or (y < 0) or (x >= width) or (y >= height) or (z < -1.0f)) {
+		return;
+	}
+	int index = y * width + x;
+	if (z > depth_buffer[index]) {
+		return;
+	}
+	depth_buffer[index] = z;
+	colour_buffer[index * 3 + 0] = (uint8_t)(fill.r * 255 + 0.5f);
+	colour_buffer[index * 3 + 1] = (uint8_t)(fill.g * 255 + 0.5f);
+	colour_buffer[index * 3 + 2] = (uint8_t)(fill.b * 255 + 0.5f);
+}
+
+void SoftwareCanvas::fillTriangle(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c, Colour fill) {
+	if (!(a.visible and b.visible and c.visible)) {
+		return;
+	}
+	float area = (b.x - a.x) * (c.y - a.y) - (b.y - a.y) * (c.x - a.x);
+	if (area == 0) {
+		return;
+	}
+
+	int min_x = std::max(0, (int)std::floor(std::min({ a.x, b.x, c.x })));
+	int max_x = std::min(width - 1, (int)std::ceil(std::max({ a.x, b.x, c.x })));
+	int min_y = std::max(0, (int)std::floor(std::min({ a.y, b.y, c.y })));
+	int max_y = std::min(height - 1, (int)std::ceil(std::max({ a.y, b.y, c.y })));
+
+	// Sample at pixel centres, keeping pixels on the same side of all three edges as the triangle itself
+	for (int y = min_y; y <= max_y; y++) {
+		float py = y + 0.5f;
+		for (int x = min_x; x <= max_x; x++) {
+			float px = x + 0.5f;
+			float wa = ((b.x - px) * (c.y - py) - (b.y - py) * (c.x - px)) / area;
+			float wb = ((c.x - px) * (a.y - py) - (c.y - py) * (a.x - px)) / area;
+			float wc = 1.0f - wa - wb;
+			if ((wa >= 0) and (wb >= 0) and (wc >= 0)) {
+				plot(x, y, wa * a.z + wb * b.z + wc * c.z, fill);
+			}
+		}
+	}
+}
+
+void SoftwareCanvas::drawLine(const ScreenVertex& a, const ScreenVertex& b, Colour fill) {
+	if (!(a.visible and b.visible)) {
+		return;
+	}
+	float dx = b.x - a.x;
+	float dy = b.y - a.y;
+	int steps = std::max(1, (int)std::ceil(std::max(std::fabs(dx), std::fabs(dy))));
+	for (int i = 0; i <= steps; i++) {
+		float t = (float)i / steps;
+		plot((int)std::floor(a.x + dx * t), (int)std::floor(a.y + dy * t), a.z + (b.z - a.z) * t, fill);
+	}
+}
+
+void SoftwareCanvas::solidCube(float size) {
+	/* Six flat-shaded faces, like glutSolidCube */
+	static const float normals[6][3] = { { 1, 0, 0 }, { -1, 0, 0 }, { 0, 1, 0 }, { 0, -1, 0 }, { 0, 0, 1 }, { 0, 0, -1 } };
+	static const float corners[6][4][3] = {
+		{ { 1, -1, -1 }, { 1, 1, -1 }, { 1, 1, 1 }, { 1, -1, 1 } },
+		{ { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, 1 }, { -1, 1, -1 } },
+		{ { -1, 1, -1 }, { -1, 1, 1 }, { 1, 1, 1 }, { 1, 1, -1 } },
+		{ { -1, -1, -1 }, { 1, -1, -1 }, { 1, -1, 1 }, { -1, -1, 1 } },
+		{ { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } },
+		{ { -1, -1, -1 }, { -1, 1, -1 }, { 1, 1, -1 }, { 1, -1, -1 } },
+	};
+
+	float half = size / 2;
+	for (int face = 0; face < 6; face++) {
+		ScreenVertex vertices[4];
+		for (int i = 0; i < 4; i++) {
+			float position[3] = { corners[face][i][0] * half, corners[face][i][1] * half, corners[face][i][2] * half };
+			vertices[i] = project(position);
+		}
+		Colour fill = lighting ? lightFace(normals[face]) : colour;
+		fillTriangle(vertices[0], vertices[1], vertices[2], fill);
+		fillTriangle(vertices[0], vertices[2], vertices[3], fill);
+	}
+}
+
+void SoftwareCanvas::lineLoop(const float vertices[][3], int count) {
+	Colour fill = lighting ? lightFace(LINE_NORMAL) : colour;
+	for (int i = 0; i < count; i++) {
+		drawLine(project(vertices[i]), project(vertices[(i + 1) % count]), fill);
+	}
+}
+
+void SoftwareCanvas::strokeCharacter(char character) {
+	/* Draw a glyph of the stroke font and move past it. Characters outside printable ASCII draw nothing. */
+	if ((character < ' ') or (character > '~')) {
+		return;
+	}
+	const StrokeGlyph& glyph = strokeFont()[character - ' '];
+	Colour fill = lighting ? lightFace(LINE_NORMAL) : colour;
+	for (const auto& stroke : glyph.strokes) {
+		for (size_t i = 0; i + 1 < stroke.size(); i++) {
+			float start[3] = { stroke[i][0], stroke[i][1], 0.0f };
+			float end[3] = { stroke[i + 1][0], stroke[i + 1][1], 0.0f };
+			drawLine(project(start), project(end), fill);
+		}
+		if (stroke.size() == 1) {
+			float point[3] = { stroke[0][0], stroke[0][1], 0.0f };
+			ScreenVertex vertex = project(point);
+			drawLine(vertex, vertex, fill);
+		}
+	}
+	translate(glyph.advance, 0.0f, 0.0f);
+}
+
+/* --------------------------------------------------------------------------------------------------------------- */
+
+bool writePPM(const char* path, int width, int height, const uint8_t* pixels) {
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	fprintf(file, "P6\n%d %d\n255\n", width, height);
+	fwrite(pixels, 3, (size_t)width * height, file);
+	return fclose(file) == 0;
+}
+
+static uint32_t crc32(uint32_t crc, const uint8_t* data, size_t length) {
+	static uint32_t table[256];
+	static bool table_ready = [] {
+		for (uint32_t n = 0; n < 256; n++) {
+			uint32_t c = n;
+			for (int k = 0; k < 8; k++) {
+				c = (c & 1) ? (0xEDB88320u ^ (c >> 1)) : (c >> 1);
+			}
+			table[n] = c;
+		}
+		return true;
+	}();
+	(void)table_ready;
+
+	crc = ~crc;
+	for (size_t i = 0; i < length; i++) {
+		crc = table[(crc ^ data[i]) & 0xFF] ^ (crc >> 8);
+	}
+	return ~crc;
+}
+
+static void appendBigEndian(std::vector<uint8_t>& out, uint32_t value) {
+	out.push_back((uint8_t)(value >> 24));
+	out.push_back((uint8_t)(value >> 16));
+	out.push_back((uint8_t)(value >> 8));
+	out.push_back((uint8_t)value);
+}
+
+static void writeChunk(FILE* file, const char type[4], const std::vector<uint8_t>& data) {
+	std::vector<uint8_t> chunk;
+	appendBigEndian(chunk, (uint32_t)data.size());
+	chunk.insert(chunk.end(), type, type + 4);
+	chunk.insert(chunk.end(), data.begin(), data.end());
+	appendBigEndian(chunk, crc32(0, chunk.data() + 4, chunk.size() - 4));
+	fwrite(chunk.data(), 1, chunk.size(), file);
+}
+
+bool writePNG(const char* path, int width, int height, const uint8_t* pixels) {
+	/* PNG with the image data in stored (uncompressed) deflate blocks, so no compression library is needed */
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	static const uint8_t signature[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	fwrite(signature, 1, sizeof(signature), file);
+
+	std::vector<uint8_t> header;
+	appendBigEndian(header, width);
+	appendBigEndian(header, height);
+	header.insert(header.end(), { 8, 2, 0, 0, 0 });	// 8 bit RGB, no interlacing
+	writeChunk(file, "IHDR", header);
+
+	// Every row starts with filter type 0 (none)
+	size_t row_bytes = (size_t)width * 3;
+	std::vector<uint8_t> raw;
+	raw.reserve((row_bytes + 1) * height);
+	for (int y = 0; y < height; y++) {
+		raw.push_back(0);
+		raw.insert(raw.end(), pixels + y * row_bytes, pixels + (y + 1) * row_bytes);
+	}
+
+	// zlib stream of stored blocks, followed by the Adler-32 checksum
+	std::vector<uint8_t> compressed = { 0x78, 0x01 };
+	const size_t max_block = 65535;
+	for (size_t offset = 0; offset < raw.size(); offset += max_block) {
+		size_t length = std::min(max_block, raw.size() - offset);
+		compressed.push_back((offset + length >= raw.size()) ? 1 : 0);
+		compressed.push_back((uint8_t)length);
+		compressed.push_back((uint8_t)(length >> 8));
+		compressed.push_back((uint8_t)~length);
+		compressed.push_back((uint8_t)(~length >> 8));
+		compressed.insert(compressed.end(), raw.begin() + offset, raw.begin() + offset + length);
+	}
+	// Adler-32, reducing modulo 65521 only every 5552 bytes, the most that can be summed without overflow
+	uint32_t adler_a = 1, adler_b = 0;
+	for (size_t offset = 0; offset < raw.size(); offset += 5552) {
+		size_t end = std::min(raw.size(), offset + 5552);
+		for (size_t i = offset; i < end; i++) {
+			adler_a += raw[i];
+			adler_b += adler_a;
+		}
+		adler_a %= 65521;
+		adler_b %= 65521;
+	}
+	appendBigEndian(compressed, (adler_b << 16) | adler_a);
+	writeChunk(file, "IDAT", compressed);
+
+	writeChunk(file, "IEND", std::vector<uint8_t>());
+	return fclose(file) == 0;
+}
@@ -0,0 +1,81 @@
+#pragma once
+
+/* Software renderer.
+
+   SoftwareCanvas draws the same scene as the window, entirely on the CPU, into an RGB image with a depth buffer.
+   It needs no display, GPU or OpenGL context, so replays can be rendered on a headless server.
+
+   It mirrors the fixed-function setup in Tetris.cpp: the same camera projection, flat-shaded cubes lit by the
+   two directional lights in render.h, and one-pixel lines, lit with LINE_NORMAL while lighting is on. Text is drawn with a built-in stroke font
+   sized like GLUT_STROKE_ROMAN, so it takes up the same space but the letterforms are simpler.
+*/
+
+#include <array>
+#include <vector>
+#include <stdint.h>
+
+#include "render.h"
+
+class SoftwareCanvas : public Canvas {
+private:
+	typedef std::array<std::array<float, 4>, 4> Matrix;
+
+	int width;
+	int height;
+	std::vector<uint8_t> colour_buffer;	// RGB, top row first
+	std::vector<float> depth_buffer;
+
+	Matrix projection;
+	std::vector<Matrix> matrix_stack;
+	Matrix modelview;
+
+	Colour colour = { 1.0f, 1.0f, 1.0f };
+	bool lighting = false;
+
+	struct ScreenVertex {
+		float x;
+		float y;
+		float z;
+		bool visible;	// False if the vertex is behind the near plane
+	};
+
+	ScreenVertex project(const float position[3]) const;
+	Colour lightFace(const float normal[3]) const;
+	void fillTriangle(const ScreenVertex& a, const ScreenVertex& b, const ScreenVertex& c, Colour fill);
+	void drawLine(const ScreenVertex& a, const ScreenVertex& b, Colour fill);
+	void plot(int x, int y, float z, Colour fill);
+
+public:
+	SoftwareCanvas(int width, int height);
+
+	// Clear the image to the given colour and reset the depth buffer
+	void clear(Colour background);
+
+	int getWidth() const {
+		return width;
+	}
+
+	int getHeight() const {
+		return height;
+	}
+
+	// RGB pixels, three bytes each, top row first
+	const uint8_t* pixels() const {
+		return colour_buffer.data();
+	}
+
+	void lookAt(float eye_x, float eye_y, float eye_z, float centre_x, float centre_y, float centre_z, float up_x, float up_y, float up_z) override;
+	void pushMatrix() override;
+	void popMatrix() override;
+	void translate(float x, float y, float z) override;
+	void scale(float x, float y, float z) override;
+	void setColour(Colour colour) override;
+	void setLighting(bool enabled) override;
+	void solidCube(float size) override;
+	void lineLoop(const float vertices[][3], int count) override;
+	void strokeCharacter(char character) override;
+};
+
+// Write RGB pixels (top row first) as a binary PPM or an uncompressed PNG. Both return false on failure.
+bool writePPM(const char* path, int width, int height, const uint8_t* pixels);
+bool writePNG(const char* path, int width, int height, const uint8_t* pixels);
@@ -0,0 +1,303 @@
+#pragma once
+
+/* Spectator streams: one game fanned out to any number of viewers.
+
+   A stream is a KEYFRAME followed by DELTAs, each numbered one higher than the last. A keyframe carries the whole
+   state, the same as a STATE message. A delta carries only what changed since the previous message:
+       uint32 session, uint32 sequence, uint8 flags, then for each flag that is set, in this order
+       DELTA_NEW_PIECE   uint8 piece, uint8 rotation, int8 x, int8 y, uint8 next piece
+       DELTA_MOVED       int8 dx, int8 dy, int8 rotation change         (same piece as before)
+       DELTA_SCORE       int32 score, uint32 rows cleared, uint16 level
+       DELTA_CLEARED     uint32 rows                                     bitmask of the rows removed, see collapseRows()
+       DELTA_CELLS       uint8 count, then count * (uint8 index, uint8 tile)   index is y * BOARD_WIDTH + x
+       DELTA_GAME_OVER   nothing
+   Cleared rows are applied before the changed cells, so the cells of a piece that cleared lines arrive where they
+   ended up after the rows above dropped.
+
+   Each message is encoded once by the session's StatePublisher and the same buffer is queued for every
+   subscriber, so the cost of a publish doesn't depend on how many people are watching. A keyframe is sent every
+   KEYFRAME_INTERVAL messages, and the publisher keeps the latest keyframe and the deltas since it so a late
+   joiner can be sent those and be up to date.
+*/
+
+#include <memory>
+#include <string.h>
+#include <string>
+#include <vector>
+#include <stdint.h>
+
+#include "engine.h"
+#include "protocol.h"
+
+// An encoded frame that can be queued on any number of connections without copying
+typedef std::shared_ptr<const std::string> SharedFrame;
+
+// Messages between keyframes
+const uint32_t KEYFRAME_INTERVAL = 64;
+
+// Changed cells above which a keyframe is sent instead of a delta
+const int MAX_DELTA_CELLS = 48;
+
+const uint8_t DELTA_NEW_PIECE = 1 << 0;
+const uint8_t DELTA_MOVED = 1 << 1;
+const uint8_t DELTA_SCORE = 1 << 2;
+const uint8_t DELTA_CLEARED = 1 << 3;
+const uint8_t DELTA_CELLS = 1 << 4;
+const uint8_t DELTA_GAME_OVER = 1 << 5;
+
+struct SpectatorState {
+	/* What a viewer knows about a game. Rows above BOARD_HEIGHT are never sent and stay empty. */
+	int32_t score = 0;
+	uint32_t rows_cleared = 0;
+	uint16_t level = 1;
+	bool game_over = false;
+	uint8_t piece = 0;
+	uint8_t rotation = 0;
+	int8_t x = 0;
+	int8_t y = 0;
+	uint8_t next_piece = 0;
+	TileState board[BOARD_WIDTH][BOARD_ROWS] = {};
+};
+
+class StatePublisher {
+	/* Turns a session's game into a spectator stream. Lives on the thread that owns the game. */
+private:
+	SpectatorState sent;	// The state as viewers will have it after the last message
+	uint32_t pieces_placed = 0;
+	uint32_t clears = 0;
+	uint32_t sequence = 0;
+	uint32_t since_keyframe = 0;
+	bool need_keyframe = true;
+	std::vector<SharedFrame> catch_up;
+
+	void remember(const Game& game) {
+		const Shape& shape = game.getCurrentShape();
+		absolutecoords position = shape.getPosition();
+		sent.score = game.getScore();
+		sent.rows_cleared = game.getRowsCleared();
+		sent.level = game.getLevel();
+		sent.game_over = game.isGameOver();
+		sent.piece = static_cast<uint8_t>(shape.getPieceType());
+		sent.rotation = shape.getRotation();
+		sent.x = position.x;
+		sent.y = position.y;
+		sent.next_piece = static_cast<uint8_t>(game.getNextShape().getPieceType());
+		pieces_placed = game.getPiecesPlaced();
+		clears = game.getClears();
+	}
+
+	SharedFrame keyframe(uint32_t session, const Game& game) {
+		std::string out;
+		MessageWriter writer(out);
+		writer.begin((uint8_t)ServerMessage::KEYFRAME).u32(session).u32(++sequence);
+		encodeState(writer, game);
+		writer.end();
+
+		remember(game);
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			for (int y = 0; y < BOARD_ROWS; y++) {
+				sent.board[x][y] = (y < BOARD_HEIGHT) ? game.getTile(x, y) : TileState::EMPTY;
+			}
+		}
+		need_keyframe = false;
+		since_keyframe = 0;
+		catch_up.clear();
+		catch_up.push_back(std::make_shared<const std::string>(std::move(out)));
+		return catch_up.back();
+	}
+
+public:
+	// Start the next publish with a keyframe, for when the game has been replaced
+	void reset() {
+		need_keyframe = true;
+	}
+
+	// The latest keyframe and every delta since, which bring a new viewer up to date
+	const std::vector<SharedFrame>& catchUp() const {
+		return catch_up;
+	}
+
+	SharedFrame publish(uint32_t session, const Game& game) {
+		/* Encode what has changed since the last publish. Returns null if nothing has. */
+		if (need_keyframe or (since_keyframe + 1 >= KEYFRAME_INTERVAL) or (game.getClears() - clears > 1)) {
+			return keyframe(session, game);
+		}
+
+		const Shape& shape = game.getCurrentShape();
+		absolutecoords position = shape.getPosition();
+		uint8_t flags = 0;
+		if (game.getPiecesPlaced() != pieces_placed) {
+			flags |= DELTA_NEW_PIECE;
+		}
+		else if ((position.x != sent.x) or (position.y != sent.y) or (shape.getRotation() != sent.rotation)) {
+			flags |= DELTA_MOVED;
+		}
+		if ((game.getScore() != sent.score) or ((uint32_t)game.getRowsCleared() != sent.rows_cleared) or (game.getLevel() != sent.level)) {
+			flags |= DELTA_SCORE;
+		}
+
+		// Bring the board viewers have in line with the game: first the same row collapse, then whatever differs
+		TileState board[BOARD_WIDTH][BOARD_ROWS];
+		memcpy(board, sent.board, sizeof(board));
+		if (game.getClears() != clears) {
+			flags |= DELTA_CLEARED;
+			collapseRows(board, game.getLastClearedRows());
+		}
+		uint8_t changed[MAX_DELTA_CELLS][2];
+		int num_changed = 0;
+		for (int y = 0; y < BOARD_HEIGHT; y++) {
+			for (int x = 0; x < BOARD_WIDTH; x++) {
+				TileState tile = game.getTile(x, y);
+				if (tile == board[x][y]) {
+					continue;
+				}
+				if (num_changed == MAX_DELTA_CELLS) {
+					return keyframe(session, game);
+				}
+				changed[num_changed][0] = (uint8_t)(y * BOARD_WIDTH + x);
+				changed[num_changed][1] = static_cast<uint8_t>(tile);
+				num_changed++;
+				board[x][y] = tile;
+			}
+		}
+		if (num_changed > 0) {
+			flags |= DELTA_CELLS;
+		}
+		if (game.isGameOver() and !sent.game_over) {
+			flags |= DELTA_GAME_OVER;
+		}
+		if (flags == 0) {
+			return nullptr;
+		}
+
+		std::string out;
+		MessageWriter writer(out);
+		writer.begin((uint8_t)ServerMessage::DELTA).u32(session).u32(++sequence).u8(flags);
+		if (flags & DELTA_NEW_PIECE) {
+			writer.u8(static_cast<uint8_t>(shape.getPieceType())).u8(shape.getRotation())
+				.u8((uint8_t)position.x).u8((uint8_t)position.y)
+				.u8(static_cast<uint8_t>(game.getNextShape().getPieceType()));
+		}
+		if (flags & DELTA_MOVED) {
+			writer.u8((uint8_t)(position.x - sent.x)).u8((uint8_t)(position.y - sent.y)).u8((uint8_t)(shape.getRotation() - sent.rotation));
+		}
+		if (flags & DELTA_SCORE) {
+			writer.u32((uint32_t)game.getScore()).u32(game.getRowsCleared()).u16(game.getLevel());
+		}
+		if (flags & DELTA_CLEARED) {
+			writer.u32(game.getLastClearedRows());
+		}
+		if (flags & DELTA_CELLS) {
+			writer.u8(num_changed).bytes(&changed[0][0], num_changed * 2);
+		}
+		writer.end();
+
+		remember(game);
+		memcpy(sent.board, board, sizeof(board));
+		since_keyframe++;
+		catch_up.push_back(std::make_shared<const std::string>(std::move(out)));
+		return catch_up.back();
+	}
+};
+
+class SpectatorView {
+	/* Rebuilds a game's state from its spectator stream. Deltas before the first keyframe, or repeats of ones
+	   already seen, are ignored. If a delta is missing the view waits for the next keyframe.
+	*/
+public:
+	SpectatorState state;
+	uint32_t sequence = 0;
+	bool synced = false;
+	uint32_t gaps = 0;
+
+	bool apply(uint8_t type, MessageReader& body) {
+		/* Apply a KEYFRAME or DELTA body, after its session id. Returns false if the message is malformed. */
+		uint32_t message_sequence = body.u32();
+		if ((ServerMessage)type == ServerMessage::KEYFRAME) {
+			return applyKeyframe(message_sequence, body);
+		}
+		if (!synced or (message_sequence <= sequence)) {
+			return !body.failed;
+		}
+		if (message_sequence != sequence + 1) {
+			synced = false;
+			gaps++;
+			return true;
+		}
+
+		uint8_t flags = body.u8();
+		if (flags & DELTA_NEW_PIECE) {
+			state.piece = body.u8();
+			state.rotation = body.u8();
+			state.x = (int8_t)body.u8();
+			state.y = (int8_t)body.u8();
+			state.next_piece = body.u8();
+		}
+		if (flags & DELTA_MOVED) {
+			state.x += (int8_t)body.u8();
+			state.y += (int8_t)body.u8();
+			state.rotation += (int8_t)body.u8();
+		}
+		if (flags & DELTA_SCORE) {
+			state.score = (int32_t)body.u32();
+			state.rows_cleared = body.u32();
+			state.level = body.u16();
+		}
+		if (flags & DELTA_CLEARED) {
+			uint32_t rows = body.u32();
+			if (rows >> BOARD_HEIGHT) {
+				return false;
+			}
+			collapseRows(state.board, rows);
+		}
+		if (flags & DELTA_CELLS) {
+			int count = body.u8();
+			const uint8_t* cells = body.bytes(count * 2);
+			for (int i = 0; cells and (i < count); i++) {
+				int index = cells[i * 2];
+				if (index >= BOARD_WIDTH * BOARD_HEIGHT) {
+					return false;
+				}
+				state.board[index % BOARD_WIDTH][index / BOARD_WIDTH] = (TileState)(cells[i * 2 + 1] & 0x0F);
+			}
+		}
+		if (flags & DELTA_GAME_OVER) {
+			state.game_over = true;
+		}
+		if (body.failed) {
+			return false;
+		}
+		sequence = message_sequence;
+		return true;
+	}
+
+private:
+	bool applyKeyframe(uint32_t message_sequence, MessageReader& body) {
+		body.u32();		// ticks
+		state.score = (int32_t)body.u32();
+		state.rows_cleared = body.u32();
+		state.level = body.u16();
+		state.game_over = (body.u8() & 1) != 0;
+		state.piece = body.u8();
+		state.rotation = body.u8();
+		state.x = (int8_t)body.u8();
+		state.y = (int8_t)body.u8();
+		state.next_piece = body.u8();
+		body.u8();
+		const uint8_t* board = body.bytes(BOARD_BYTES);
+		if (body.failed) {
+			return false;
+		}
+		for (int i = 0; i < BOARD_WIDTH * BOARD_HEIGHT; i++) {
+			state.board[i % BOARD_WIDTH][i / BOARD_WIDTH] = (TileState)((board[i / 2] >> ((i % 2) * 4)) & 0x0F);
+		}
+		for (int x = 0; x < BOARD_WIDTH; x++) {
+			for (int y = BOARD_HEIGHT; y < BOARD_ROWS; y++) {
+				state.board[x][y] = TileState::EMPTY;
+			}
+		}
+		sequence = message_sequence;
+		synced = true;
+		return true;
+	}
+};
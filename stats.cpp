@@ -0,0 +1,282 @@
+/* Queries and maintains the game statistics store in stats.h.
+
+   Usage: tetris_stats --dir DIR [options]
+     --top N            print the N best games (default: 10, at most 1024)
+     --days N           print the totals of each of the last N days
+     --replay RANK      write the replay of the game at RANK (1 is the best) in the top table to --out
+     --out FILE         where --replay writes to (default: <seed>.replay)
+     --play N           play N games with random actions and add them to the store, for filling a store to test with
+     --seed N           seed of the first game --play plays, game i uses seed + i (default: 1)
+     --spread N         spread the games --play adds over the last N days (default: 1, all today)
+     --batch N          games written at a time by --play (default: 256)
+     --verify           read the whole log, report records with a bad checksum, and check the index matches the rest
+
+   Queries only read the index, so they take the same time however many games the log holds. --verify is the one
+   thing that reads the whole log.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <errno.h>
+#include <map>
+#include <string>
+#include <vector>
+
+#include "engine.h"
+#include "stats.h"
+
+typedef std::chrono::steady_clock stats_clock;
+
+static uint64_t nowMilliseconds() {
+	return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+}
+
+static std::string formatDay(uint32_t day) {
+	time_t seconds = (time_t)day * 86400;
+	struct tm date;
+	gmtime_r(&seconds, &date);
+	char text[16];
+	strftime(text, sizeof(text), "%Y-%m-%d", &date);
+	return text;
+}
+
+static void printTop(const StatsStore& store, size_t n) {
+	size_t count;
+	const GameRecord* top = store.getTop(count);
+	count = std::min(count, n);
+	printf("%4s %10s %6s %6s %7s %8s %10s  %s\n", "rank", "score", "level", "rows", "pieces", "time", "date", "seed");
+	for (size_t i = 0; i < count; i++) {
+		const GameRecord& game = top[i];
+		printf("%4zu %10d %6d %6d %7u %7.1fs %10s  %llu\n", i + 1, game.score, game.level, game.rows_cleared, game.pieces,
+			game.duration_ms / 1000.0, formatDay(game.finished_at / MS_PER_DAY).c_str(), (unsigned long long)game.seed);
+	}
+}
+
+static void printDays(const StatsStore& store, uint32_t days) {
+	uint32_t today = nowMilliseconds() / MS_PER_DAY;
+	size_t count;
+	const DayStats* stats = store.getDays(today - std::min(today, days - 1), today, count);
+	printf("%10s %8s %8s %10s %12s %10s %10s\n", "date", "games", "topped", "best", "mean score", "mean rows", "play time");
+	for (size_t i = 0; i < count; i++) {
+		const DayStats& day = stats[i];
+		printf("%10s %8u %8u %10d %12.1f %10.1f %9.1fh\n", formatDay(day.day).c_str(), day.games, day.finished, day.best_score,
+			(double)day.total_score / day.games, (double)day.total_rows / day.games, day.total_duration_ms / 3600000.0);
+	}
+}
+
+static int play(StatsStore& store, uint64_t first_seed, uint64_t games, uint32_t spread_days) {
+	/* Add games played with random actions, finishing at even intervals over the last spread_days days */
+	stats_clock::time_point start = stats_clock::now();
+	uint64_t now = nowMilliseconds();
+	uint64_t span = (uint64_t)spread_days * MS_PER_DAY;
+	for (uint64_t i = 0; i < games; i++) {
+		uint64_t seed = first_seed + i;
+		Game game(seed);
+		PieceRandom random(seed ^ 0x5DEECE66DULL);
+		Replay replay;
+		replay.seed = seed;
+		while (!game.isGameOver()) {
+			// Act on one tick in four, and slam one action in sixteen so games don't take too long
+			if (random.nextBelow(4) == 0) {
+				const Action moves[4] = { Action::LEFT, Action::RIGHT, Action::ROTATE_CLOCKWISE, Action::ROTATE_COUNTERCLOCKWISE };
+				int roll = random.nextBelow(16);
+				Action action = (roll == 0) ? Action::SLAM : moves[roll % 4];
+				replay.events.push_back(ReplayEvent{ game.getTicks(), action });
+				game.apply(action);
+			}
+			game.tick();
+		}
+		replay.end_tick = game.getTicks();
+		uint64_t finished_at = now - span + (span * (i + 1)) / games;
+		if (!store.add(make_game_record(game, seed, finished_at, game.getTicks() * 50), &replay)) {
+			perror("Could not write to the store");
+			return 1;
+		}
+	}
+	if (!store.flush()) {
+		perror("Could not write to the store");
+		return 1;
+	}
+	double seconds = std::chrono::duration<double>(stats_clock::now() - start).count();
+	printf("Added %llu games in %.2f s (%.0f games/s), the log holds %llu\n", (unsigned long long)games, seconds, games / seconds,
+		(unsigned long long)store.getRecords());
+	return 0;
+}
+
+static int verify(const StatsStore& store) {
+	/* Rebuild the top table and day totals from the whole log and compare them with the index */
+	stats_clock::time_point start = stats_clock::now();
+	std::vector<GameRecord> finished;
+	std::vector<GameRecord> block(4096);
+	std::map<uint32_t, DayStats> days;
+	uint64_t bad = 0;
+	for (uint64_t first = 0; first < store.getRecords(); first += block.size()) {
+		size_t count = (size_t)std::min<uint64_t>(block.size(), store.getRecords() - first);
+		if (!store.readRecords(first, count, block.data())) {
+			perror("Could not read the log");
+			return 1;
+		}
+		for (size_t i = 0; i < count; i++) {
+			const GameRecord& record = block[i];
+			if (record.checksum != stats_checksum(record)) {
+				// The index leaves these out, so they are left out of the comparison too
+				printf("Record %llu has a bad checksum\n", (unsigned long long)(first + i));
+				bad++;
+				continue;
+			}
+			// Only games played to the end are ranked
+			if (record.flags & GAME_RECORD_OVER) {
+				finished.push_back(record);
+			}
+			DayStats& day = days[record.finished_at / MS_PER_DAY];
+			if ((day.games == 0) or (record.score > day.best_score)) {
+				day.best_score = record.score;
+			}
+			day.games++;
+			day.total_score += record.score;
+			day.total_rows += record.rows_cleared;
+		}
+	}
+	std::stable_sort(finished.begin(), finished.end(), [](const GameRecord& a, const GameRecord& b) { return a.score > b.score; });
+
+	int mismatches = 0;
+	size_t count;
+	const GameRecord* top = store.getTop(count);
+	if (count != std::min<size_t>(finished.size(), TOP_CAPACITY)) {
+		printf("Top table holds %zu games, expected %zu\n", count, std::min<size_t>(finished.size(), TOP_CAPACITY));
+		mismatches++;
+	}
+	for (size_t i = 0; i < std::min(count, finished.size()); i++) {
+		if (memcmp(&top[i], &finished[i], sizeof(GameRecord)) != 0) {
+			printf("Top table differs at rank %zu\n", i + 1);
+			mismatches++;
+			break;
+		}
+	}
+	const DayStats* indexed = store.getDays(0, UINT32_MAX, count);
+	if (count != days.size()) {
+		printf("Index has %zu days, expected %zu\n", count, days.size());
+		mismatches++;
+	}
+	for (size_t i = 0; i < count; i++) {
+		auto found = days.find(indexed[i].day);
+		if ((found == days.end()) or (found->second.games != indexed[i].games) or (found->second.best_score != indexed[i].best_score)
+			or (found->second.total_score != indexed[i].total_score) or (found->second.total_rows != indexed[i].total_rows)) {
+			printf("Totals for %s differ\n", formatDay(indexed[i].day).c_str());
+			mismatches++;
+		}
+	}
+	double seconds = std::chrono::duration<double>(stats_clock::now() - start).count();
+	printf("Checked %llu records, %llu with a bad checksum, and %zu days in %.2f s: %s\n", (unsigned long long)store.getRecords(),
+		(unsigned long long)bad, days.size(), seconds, (mismatches == 0) ? "index matches the log" : "INDEX DOES NOT MATCH");
+	return ((mismatches == 0) and (bad == 0)) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	const char* dir = nullptr;
+	size_t top = 0;
+	uint32_t days = 0;
+	size_t replay_rank = 0;
+	std::string out;
+	uint64_t play_games = 0;
+	uint64_t seed = 1;
+	uint32_t spread = 1;
+	size_t batch = 256;
+	bool check = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--dir") and has_value) {
+			dir = argv[++i];
+		}
+		else if ((arg == "--top") and has_value) {
+			top = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--days") and has_value) {
+			days = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--replay") and has_value) {
+			replay_rank = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--out") and has_value) {
+			out = argv[++i];
+		}
+		else if ((arg == "--play") and has_value) {
+			play_games = strtoull(argv[++i], nullptr, 10);
+		}
+		else if ((arg == "--seed") and has_value) {
+			seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if ((arg == "--spread") and has_value) {
+			spread = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--batch") and has_value) {
+			batch = std::max(1, atoi(argv[++i]));
+		}
+		else if (arg == "--verify") {
+			check = true;
+		}
+		else {
+			dir = nullptr;
+			break;
+		}
+	}
+	if (dir == nullptr) {
+		fprintf(stderr, "Usage: %s --dir DIR [--top N] [--days N] [--replay RANK [--out FILE]] [--verify]\n"
+			"       %s --dir DIR --play N [--seed N] [--spread DAYS] [--batch N]\n", argv[0], argv[0]);
+		return 2;
+	}
+
+	stats_clock::time_point start = stats_clock::now();
+	StatsStore store;
+	if (!store.open(dir)) {
+		if (errno == EWOULDBLOCK) {
+			fprintf(stderr, "%s is open in another process\n", dir);
+		}
+		else {
+			perror(dir);
+		}
+		return 1;
+	}
+	store.setBatchSize(batch);
+	printf("Opened %s, %llu games, in %.2f ms\n", dir, (unsigned long long)store.getRecords(),
+		std::chrono::duration<double, std::milli>(stats_clock::now() - start).count());
+
+	if ((play_games > 0) and (play(store, seed, play_games, spread) != 0)) {
+		return 1;
+	}
+	if ((top == 0) and (days == 0) and (replay_rank == 0) and (play_games == 0) and !check) {
+		top = 10;
+	}
+	if (top > 0) {
+		printTop(store, top);
+	}
+	if (days > 0) {
+		printDays(store, days);
+	}
+	if (replay_rank > 0) {
+		size_t count;
+		const GameRecord* best = store.getTop(count);
+		Replay replay;
+		if ((replay_rank > count) or !store.loadReplay(best[replay_rank - 1], replay)) {
+			fprintf(stderr, "No replay kept for rank %zu\n", replay_rank);
+			return 1;
+		}
+		if (out.empty()) {
+			out = std::to_string(replay.seed) + ".replay";
+		}
+		if (!saveReplay(replay, out.c_str())) {
+			perror(out.c_str());
+			return 1;
+		}
+		printf("Wrote %s\n", out.c_str());
+	}
+	if (check) {
+		return verify(store);
+	}
+	return 0;
+}
@@ -0,0 +1,606 @@
+#pragma once
+
+/* Persistent game statistics: an append-only log with a record of every game played, the replays of those games,
+   and a memory-mapped index that answers leaderboard and per-day queries without reading the log.
+
+   A store is a directory holding three files:
+     games.log     a header, then one 64-byte GameRecord per game in the order they were added
+     replays.bin   the replay of each game, one after another in the replay file format (see engine.cpp)
+     games.idx     the index: the best TOP_CAPACITY games played to the end by score, and the totals of each day
+                   (restarted and quit games included), kept up to date as games are added
+
+   Games are buffered and written in batches by flush(). A batch's replays are written and synced first, then its
+   records in a single write and sync, so a record is never on disk before the replay it points to. Each record ends
+   in a checksum and the last record of each batch is flagged. The pages of a batch can reach the disk in any order
+   until its sync returns, so when the store is opened every record of the last batch is checked, and if any of
+   them is torn the whole batch is cut off the log. A bad record anywhere else in the log is left out of the index.
+   The index can always be rebuilt from the log: it's flagged while a batch is
+   being added to it, and if it's found flagged or doesn't match the log when the store is opened, it is rebuilt.
+   If it's only behind the log, the missing records are added.
+
+   All files are little-endian and read in place, so a store is only portable between little-endian machines.
+   games.log header:
+       0   char[4] "TSTL"
+       4   uint32  version (1)
+       8   uint32  record size (64)
+       12  uint32  reserved
+   games.idx:
+       0   char[4] "TSTI"
+       4   uint32  version (2, version 1 ranked restarted and quit games too and is rebuilt)
+       8   uint64  records of the log in the index
+       16  uint32  1 while the index is being updated
+       20  uint32  games in the top table
+       24  uint32  days in the day table
+       28  uint32  days there is room for
+       32  reserved up to 64
+       64  GameRecord[TOP_CAPACITY]  best games, highest score first, and earlier games first on equal scores
+           DayStats[]                one for each day with at least one game, in order
+*/
+
+#include <algorithm>
+#include <string>
+#include <vector>
+#include <cstddef>
+#include <cstdio>
+#include <errno.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+const uint32_t STATS_VERSION = 1;
+const uint32_t STATS_INDEX_VERSION = 2;
+const size_t STATS_LOG_HEADER_SIZE = 16;
+const size_t STATS_INDEX_HEADER_SIZE = 64;
+const uint32_t TOP_CAPACITY = 1024;
+const uint64_t NO_REPLAY = ~0ULL;
+const uint64_t MS_PER_DAY = 86400000;
+
+// GameRecord flags
+const uint32_t GAME_RECORD_OVER = 1;	// The game ended by topping out, rather than being restarted or quit
+const uint32_t GAME_RECORD_BATCH_END = 2;	// The last record of a batch written by flush()
+
+// Most records written in one batch, and so the most that are checked when a store is opened
+const size_t MAX_STATS_BATCH = 4096;
+
+struct GameRecord {
+	uint64_t seed;
+	uint64_t finished_at;		// Milliseconds since the Unix epoch when the game ended
+	uint64_t replay_offset;		// Where the game's replay starts in replays.bin, NO_REPLAY if it wasn't kept
+	uint32_t replay_size;
+	int32_t score;
+	int32_t level;
+	int32_t rows_cleared;
+	uint32_t pieces;
+	uint32_t ticks;
+	uint32_t duration_ms;		// Wall-clock time the game was played for
+	uint32_t flags;
+	uint32_t reserved;
+	uint32_t checksum;			// Of the bytes before it, set when the record is written
+};
+static_assert(sizeof(GameRecord) == 64, "GameRecord is stored as is");
+
+struct DayStats {
+	uint32_t day;				// Days since the Unix epoch, in UTC
+	uint32_t games;
+	int32_t best_score;
+	uint32_t finished;			// Games that ended by topping out
+	uint64_t best_seed;
+	uint64_t total_score;
+	uint64_t total_rows;
+	uint64_t total_pieces;
+	uint64_t total_duration_ms;
+	uint64_t reserved;
+};
+static_assert(sizeof(DayStats) == 64, "DayStats is stored as is");
+
+inline GameRecord make_game_record(const Game& game, uint64_t seed, uint64_t finished_at, uint32_t duration_ms) {
+	GameRecord record = {};
+	record.seed = seed;
+	record.finished_at = finished_at;
+	record.replay_offset = NO_REPLAY;
+	record.score = game.getScore();
+	record.level = game.getLevel();
+	record.rows_cleared = game.getRowsCleared();
+	record.pieces = game.getPiecesPlaced();
+	record.ticks = game.getTicks();
+	record.duration_ms = duration_ms;
+	record.flags = game.isGameOver() ? GAME_RECORD_OVER : 0;
+	return record;
+}
+
+inline uint32_t stats_checksum(const GameRecord& record) {
+	/* FNV-1a of everything but the checksum itself */
+	const uint8_t* bytes = (const uint8_t*)&record;
+	uint32_t hash = 2166136261u;
+	for (size_t i = 0; i < offsetof(GameRecord, checksum); i++) {
+		hash = (hash ^ bytes[i]) * 16777619u;
+	}
+	return hash;
+}
+
+class StatsStore {
+private:
+	struct Pending {
+		GameRecord record;
+		Replay replay;
+		bool keep_replay;
+	};
+
+	std::string dir;
+	int log_fd = -1;
+	FILE* replays = nullptr;
+	uint64_t records = 0;		// Whole records in the log
+	std::vector<Pending> pending;
+	size_t batch_size = 64;
+
+	uint8_t* index = nullptr;
+	size_t index_size = 0;
+	int index_fd = -1;
+
+	uint64_t& indexedRecords() {
+		return *(uint64_t*)(index + 8);
+	}
+
+	uint32_t& updating() {
+		return *(uint32_t*)(index + 16);
+	}
+
+	uint32_t& topCount() {
+		return *(uint32_t*)(index + 20);
+	}
+
+	uint32_t& dayCount() {
+		return *(uint32_t*)(index + 24);
+	}
+
+	uint32_t& dayCapacity() {
+		return *(uint32_t*)(index + 28);
+	}
+
+	GameRecord* top() {
+		return (GameRecord*)(index + STATS_INDEX_HEADER_SIZE);
+	}
+
+	DayStats* days() {
+		return (DayStats*)(index + STATS_INDEX_HEADER_SIZE + TOP_CAPACITY * sizeof(GameRecord));
+	}
+
+	static size_t indexSize(uint32_t day_capacity) {
+		return STATS_INDEX_HEADER_SIZE + TOP_CAPACITY * sizeof(GameRecord) + day_capacity * sizeof(DayStats);
+	}
+
+	bool mapIndex(size_t size) {
+		/* Size the index file and map it, replacing any earlier mapping. The earlier mapping is only let go once the
+		   new one is in place, so on failure it is still there.
+		*/
+		if (ftruncate(index_fd, size) < 0) {
+			return false;
+		}
+		void* map = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, index_fd, 0);
+		if (map == MAP_FAILED) {
+			return false;
+		}
+		if (index != nullptr) {
+			munmap(index, index_size);
+		}
+		index = (uint8_t*)map;
+		index_size = size;
+		return true;
+	}
+
+	bool syncIndex() {
+		return msync(index, index_size, MS_SYNC) == 0;
+	}
+
+	bool resetIndex() {
+		/* Empty the index, ready to be rebuilt from the whole log */
+		const uint32_t initial_days = 64;
+		if (!mapIndex(indexSize(initial_days))) {
+			return false;
+		}
+		memset(index, 0, index_size);
+		memcpy(index, "TSTI", 4);
+		memcpy(index + 4, &STATS_INDEX_VERSION, 4);
+		dayCapacity() = initial_days;
+		return true;
+	}
+
+	bool indexRecord(const GameRecord& record) {
+		/* Add one game to its day's totals, and to the top table if it was played to the end rather than restarted
+		   or quit. A record with a bad checksum is left out.
+		*/
+		if (record.checksum != stats_checksum(record)) {
+			fprintf(stderr, "Left a game with a bad checksum out of the stats index\n");
+			return true;
+		}
+		GameRecord* best = top();
+		uint32_t count = topCount();
+		bool ranked = (record.flags & GAME_RECORD_OVER) != 0;
+		if (ranked and ((count < TOP_CAPACITY) or (record.score > best[count - 1].score))) {
+			GameRecord* position = std::upper_bound(best, best + count, record,
+				[](const GameRecord& a, const GameRecord& b) { return a.score > b.score; });
+			size_t moved = std::min<size_t>(best + count - position, TOP_CAPACITY - 1 - (position - best));
+			memmove(position + 1, position, moved * sizeof(GameRecord));
+			*position = record;
+			topCount() = std::min(count + 1, TOP_CAPACITY);
+		}
+
+		uint32_t day = (uint32_t)(record.finished_at / MS_PER_DAY);
+		DayStats* found = std::lower_bound(days(), days() + dayCount(), day,
+			[](const DayStats& stats, uint32_t day) { return stats.day < day; });
+		if ((found == days() + dayCount()) or (found->day != day)) {
+			// Games usually finish in order, so a new day almost always goes on the end
+			size_t position = found - days();
+			if (dayCount() == dayCapacity()) {
+				uint32_t capacity = dayCapacity() * 2;
+				if (!mapIndex(indexSize(capacity))) {
+					return false;
+				}
+				dayCapacity() = capacity;
+			}
+			found = days() + position;
+			memmove(found + 1, found, (dayCount() - position) * sizeof(DayStats));
+			*found = DayStats();
+			found->day = day;
+			found->best_score = record.score;
+			found->best_seed = record.seed;
+			dayCount()++;
+		}
+		found->games++;
+		found->finished += (record.flags & GAME_RECORD_OVER) ? 1 : 0;
+		if (record.score > found->best_score) {
+			found->best_score = record.score;
+			found->best_seed = record.seed;
+		}
+		found->total_score += record.score;
+		found->total_rows += record.rows_cleared;
+		found->total_pieces += record.pieces;
+		found->total_duration_ms += record.duration_ms;
+		return true;
+	}
+
+	bool catchUpIndex() {
+		/* Add the records the index is missing, reading the log a block at a time */
+		std::vector<GameRecord> block(4096);
+		while (indexedRecords() < records) {
+			uint64_t first = indexedRecords();
+			size_t count = (size_t)std::min<uint64_t>(block.size(), records - first);
+			if (!readRecords(first, count, block.data())) {
+				return false;
+			}
+			for (size_t i = 0; i < count; i++) {
+				if (!indexRecord(block[i])) {
+					return false;
+				}
+			}
+			indexedRecords() = first + count;
+		}
+		return true;
+	}
+
+	bool cutTornBatch() {
+		/* The last batch starts after the last whole record flagged as the end of one, looking back at most
+		   MAX_STATS_BATCH records. If one of its records is bad, records is moved back to where it starts.
+		*/
+		if (records == 0) {
+			return true;
+		}
+		size_t count = (size_t)std::min<uint64_t>(records, MAX_STATS_BATCH + 1);
+		std::vector<GameRecord> tail(count);
+		uint64_t first = records - count;
+		if (!readRecords(first, count, tail.data())) {
+			return false;
+		}
+		size_t start = 0;
+		for (size_t i = count - 1; i > 0; i--) {
+			const GameRecord& record = tail[i - 1];
+			if ((record.flags & GAME_RECORD_BATCH_END) and (record.checksum == stats_checksum(record))) {
+				start = i;
+				break;
+			}
+		}
+		for (size_t i = start; i < count; i++) {
+			if (tail[i].checksum != stats_checksum(tail[i])) {
+				records = first + start;
+				break;
+			}
+		}
+		return true;
+	}
+
+	bool updateIndex(const std::vector<GameRecord>& batch) {
+		updating() = 1;
+		if (!syncIndex()) {
+			return false;
+		}
+		for (const GameRecord& record : batch) {
+			if (!indexRecord(record)) {
+				return false;
+			}
+		}
+		indexedRecords() = records;
+		updating() = 0;
+		return syncIndex();
+	}
+
+	void dropIndex() {
+		/* Stop using an index that couldn't be updated, which leaves the store closed to queries and new games */
+		if (index != nullptr) {
+			munmap(index, index_size);
+			index = nullptr;
+			index_size = 0;
+		}
+	}
+
+	bool openLog() {
+		std::string path = dir + "/games.log";
+		log_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (log_fd < 0) {
+			return false;
+		}
+		if (flock(log_fd, LOCK_EX | LOCK_NB) < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(log_fd, &info) < 0) {
+			return false;
+		}
+		uint8_t header[STATS_LOG_HEADER_SIZE] = { 'T', 'S', 'T', 'L' };
+		uint32_t record_size = sizeof(GameRecord);
+		if (info.st_size == 0) {
+			memcpy(header + 4, &STATS_VERSION, 4);
+			memcpy(header + 8, &record_size, 4);
+			if ((pwrite(log_fd, header, sizeof(header), 0) != (ssize_t)sizeof(header)) or (fsync(log_fd) < 0)) {
+				return false;
+			}
+			info.st_size = sizeof(header);
+		}
+		uint8_t found[STATS_LOG_HEADER_SIZE];
+		if ((pread(log_fd, found, sizeof(found), 0) != (ssize_t)sizeof(found)) or (memcmp(found, "TSTL", 4) != 0)
+			or (memcmp(found + 4, &STATS_VERSION, 4) != 0) or (memcmp(found + 8, &record_size, 4) != 0)) {
+			errno = EINVAL;
+			return false;
+		}
+
+		// Cut off a partly written record, and the last batch if any of its records is torn
+		records = (info.st_size - STATS_LOG_HEADER_SIZE) / sizeof(GameRecord);
+		if (!cutTornBatch()) {
+			return false;
+		}
+		uint64_t size = STATS_LOG_HEADER_SIZE + records * sizeof(GameRecord);
+		if ((uint64_t)info.st_size != size) {
+			fprintf(stderr, "Cut %llu bytes of unfinished records from %s\n", (unsigned long long)(info.st_size - size), path.c_str());
+			if ((ftruncate(log_fd, size) < 0) or (fsync(log_fd) < 0)) {
+				return false;
+			}
+		}
+		return true;
+	}
+
+	bool openIndex() {
+		std::string path = dir + "/games.idx";
+		index_fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+		if (index_fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if (fstat(index_fd, &info) < 0) {
+			return false;
+		}
+		bool usable = false;
+		if ((size_t)info.st_size >= indexSize(0)) {
+			if (!mapIndex(info.st_size)) {
+				return false;
+			}
+			usable = (memcmp(index, "TSTI", 4) == 0) and (memcmp(index + 4, &STATS_INDEX_VERSION, 4) == 0) and (updating() == 0)
+				and (indexedRecords() <= records) and (topCount() <= TOP_CAPACITY) and (dayCount() <= dayCapacity())
+				and (indexSize(dayCapacity()) == index_size);
+		}
+		if (!usable and !resetIndex()) {
+			return false;
+		}
+		if (indexedRecords() < records) {
+			updating() = 1;
+			if (!syncIndex() or !catchUpIndex()) {
+				return false;
+			}
+			updating() = 0;
+			return syncIndex();
+		}
+		return true;
+	}
+
+public:
+	StatsStore() {}
+	StatsStore(const StatsStore&) = delete;
+	StatsStore& operator=(const StatsStore&) = delete;
+
+	~StatsStore() {
+		close();
+	}
+
+	bool open(const char* directory) {
+		/* Open the store in directory, creating it if needed, and recover from an earlier crash. Only one process can
+		   have a store open. Returns false with errno set on failure.
+		*/
+		close();
+		dir = directory;
+		if ((mkdir(directory, 0755) < 0) and (errno != EEXIST)) {
+			return false;
+		}
+		if (!openLog()) {
+			int error = errno;
+			close();
+			errno = error;
+			return false;
+		}
+		replays = fopen((dir + "/replays.bin").c_str(), "a+b");
+		if ((replays == nullptr) or !openIndex()) {
+			int error = errno;
+			close();
+			errno = error;
+			return false;
+		}
+		return true;
+	}
+
+	void close() {
+		/* Write any games still waiting, then close the files */
+		if (isOpen()) {
+			flush();
+		}
+		pending.clear();
+		dropIndex();
+		if (index_fd >= 0) {
+			::close(index_fd);
+			index_fd = -1;
+		}
+		if (replays != nullptr) {
+			fclose(replays);
+			replays = nullptr;
+		}
+		if (log_fd >= 0) {
+			::close(log_fd);
+			log_fd = -1;
+		}
+		records = 0;
+	}
+
+	bool isOpen() const {
+		return (log_fd >= 0) and (replays != nullptr) and (index != nullptr);
+	}
+
+	void setBatchSize(size_t size) {
+		batch_size = std::max<size_t>(1, std::min(size, MAX_STATS_BATCH));
+	}
+
+	bool add(const GameRecord& record, const Replay* replay = nullptr) {
+		/* Queue a game to be written, and write the queue once it holds a batch. Returns false if that fails. */
+		if (!isOpen()) {
+			errno = EBADF;
+			return false;
+		}
+		if ((pending.size() >= MAX_STATS_BATCH) and !flush()) {
+			return false;
+		}
+		pending.push_back(Pending{ record, (replay != nullptr) ? *replay : Replay(), replay != nullptr });
+		return (pending.size() < batch_size) or flush();
+	}
+
+	bool flush() {
+		/* Write the queued games and add them to the index. Once this returns true they survive a crash. */
+		if (!isOpen()) {
+			errno = EBADF;
+			return false;
+		}
+		if (pending.empty()) {
+			return true;
+		}
+		bool any_replays = false;
+		for (Pending& game : pending) {
+			if (game.keep_replay) {
+				fseek(replays, 0, SEEK_END);
+				long start = ftell(replays);
+				if ((start < 0) or !writeReplay(game.replay, replays)) {
+					return false;
+				}
+				game.record.replay_offset = start;
+				game.record.replay_size = (uint32_t)(ftell(replays) - start);
+				any_replays = true;
+			}
+		}
+		if (any_replays and ((fflush(replays) != 0) or (fdatasync(fileno(replays)) < 0))) {
+			return false;
+		}
+
+		std::vector<GameRecord> batch;
+		for (Pending& game : pending) {
+			game.record.flags &= ~GAME_RECORD_BATCH_END;
+			if (&game == &pending.back()) {
+				game.record.flags |= GAME_RECORD_BATCH_END;
+			}
+			game.record.checksum = stats_checksum(game.record);
+			batch.push_back(game.record);
+		}
+		const uint8_t* bytes = (const uint8_t*)batch.data();
+		size_t size = batch.size() * sizeof(GameRecord);
+		off_t offset = STATS_LOG_HEADER_SIZE + records * sizeof(GameRecord);
+		for (size_t written = 0; written < size;) {
+			ssize_t result = pwrite(log_fd, bytes + written, size - written, offset + written);
+			if (result < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+				return false;
+			}
+			written += result;
+		}
+		if (fdatasync(log_fd) < 0) {
+			return false;
+		}
+		records += batch.size();
+		pending.clear();
+		if (!updateIndex(batch)) {
+			// The log has the batch, and the flagged index is rebuilt from it when the store is next opened
+			int error = errno;
+			dropIndex();
+			errno = error;
+			return false;
+		}
+		return true;
+	}
+
+	uint64_t getRecords() const {
+		/* Games written to the log, not counting any still queued */
+		return records;
+	}
+
+	bool readRecords(uint64_t first, size_t count, GameRecord* out) const {
+		/* Read records straight from the log, by their position in it */
+		size_t size = count * sizeof(GameRecord);
+		return pread(log_fd, out, size, STATS_LOG_HEADER_SIZE + first * sizeof(GameRecord)) == (ssize_t)size;
+	}
+
+	const GameRecord* getTop(size_t& count) const {
+		/* The best games played to the end by score, best first: up to TOP_CAPACITY of them, none if the store
+		   isn't open
+		*/
+		if (index == nullptr) {
+			count = 0;
+			return nullptr;
+		}
+		count = *(const uint32_t*)(index + 20);
+		return (const GameRecord*)(index + STATS_INDEX_HEADER_SIZE);
+	}
+
+	const DayStats* getDays(uint32_t first_day, uint32_t last_day, size_t& count) const {
+		/* Totals of the days from first_day to last_day that had games, in order */
+		if (index == nullptr) {
+			count = 0;
+			return nullptr;
+		}
+		const DayStats* all = (const DayStats*)(index + STATS_INDEX_HEADER_SIZE + TOP_CAPACITY * sizeof(GameRecord));
+		const DayStats* end = all + *(const uint32_t*)(index + 24);
+		const DayStats* first = std::lower_bound(all, end, first_day,
+			[](const DayStats& stats, uint32_t day) { return stats.day < day; });
+		const DayStats* last = std::upper_bound(first, end, last_day,
+			[](uint32_t day, const DayStats& stats) { return day < stats.day; });
+		count = last - first;
+		return first;
+	}
+
+	bool loadReplay(const GameRecord& record, Replay& replay) const {
+		/* Read a game's replay back, false if it wasn't kept or can't be read */
+		if ((record.replay_offset == NO_REPLAY) or (fseek(replays, record.replay_offset, SEEK_SET) != 0)) {
+			return false;
+		}
+		return readReplay(replay, replays);
+	}
+};
@@ -0,0 +1,378 @@
+/* Builds the solved tables in tablebase.h, and checks them.
+
+   Usage: tetris_tablebase [options]
+     --width N            columns, 4 to 6 (default: 4)
+     --height N           rows (default: 5)
+     --out FILE           where to write the table (default: tablebase_<width>x<height>.tbl)
+     --threads N          threads to build with (default: one per core)
+     --tolerance F        stop once no value changes by more than this in an iteration (default: 1e-6)
+     --max-iterations N   stop after this many iterations regardless (default: 100000)
+     --check FILE         map a table and play random games with it instead of building one
+     --games N            games to play with --check (default: 10000)
+
+   Building is done in three passes, each split between threads:
+     1. Every board reachable from an empty one is found breadth first. Each level's boards are expanded in
+        parallel, and the new boards are sorted and merged into the boards seen so far.
+     2. For each board and every placement of every piece, the board it leads to is looked up once and stored, so
+        the iterations that follow never drop a piece or search for a board.
+     3. Values are found by value iteration: a board's value is the average over the seven pieces of the best
+        placement's rows cleared plus the value of the board it leaves, and a placement that ends the game is worth
+        only the rows it clears. Every board starts at zero and the values rise to the solution.
+   The values are then stored under a perfect hash, so looking one up at runtime is constant time.
+
+   --check plays games with the table's best placements and compares the rows they clear with the table's value of
+   the empty board, which they should match on average.
+*/
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <iterator>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include "engine.h"
+#include "tablebase.h"
+
+struct TablebaseOptions {
+	int width = 4;
+	int height = 5;
+	std::string out;
+	unsigned int threads = 0;
+	double tolerance = 1e-6;
+	int max_iterations = 100000;
+};
+
+// Transitions are stored as (next board index << 3) | rows cleared, with this index for a placement that ends the game
+const uint32_t GAME_OVER_INDEX = (1u << 29) - 1;
+
+typedef std::chrono::steady_clock build_clock;
+
+template <typename Work>
+static void parallelFor(unsigned int threads, size_t count, Work work) {
+	/* Split [0, count) into one contiguous range per thread and call work(thread, begin, end) for each */
+	std::vector<std::thread> workers;
+	size_t per_thread = (count + threads - 1) / threads;
+	for (unsigned int t = 0; t < threads; t++) {
+		size_t begin = std::min(count, t * per_thread);
+		size_t end = std::min(count, begin + per_thread);
+		workers.emplace_back([=, &work] { work(t, begin, end); });
+	}
+	for (std::thread& worker : workers) {
+		worker.join();
+	}
+}
+
+static double secondsSince(build_clock::time_point start) {
+	return std::chrono::duration<double>(build_clock::now() - start).count();
+}
+
+static std::vector<uint64_t> reachableBoards(const NarrowRules& rules, unsigned int threads) {
+	/* Every board that can be reached from an empty one without the game ending, sorted */
+	std::vector<uint64_t> seen{ 0 };
+	std::vector<uint64_t> frontier{ 0 };
+	std::vector<std::vector<uint64_t>> found(threads);
+
+	while (!frontier.empty()) {
+		parallelFor(threads, frontier.size(), [&](unsigned int t, size_t begin, size_t end) {
+			std::vector<uint64_t>& local = found[t];
+			local.clear();
+			for (size_t i = begin; i < end; i++) {
+				for (int piece = 0; piece < NUM_PIECE_TYPES; piece++) {
+					for (const NarrowPlacement& placement : rules.getPlacements(piece)) {
+						NarrowDrop drop = rules.drop(frontier[i], placement);
+						if (!drop.game_over) {
+							local.push_back(drop.board);
+						}
+					}
+				}
+			}
+			std::sort(local.begin(), local.end());
+			local.erase(std::unique(local.begin(), local.end()), local.end());
+		});
+
+		std::vector<uint64_t> next;
+		for (std::vector<uint64_t>& local : found) {
+			next.insert(next.end(), local.begin(), local.end());
+		}
+		std::sort(next.begin(), next.end());
+		next.erase(std::unique(next.begin(), next.end()), next.end());
+
+		frontier.clear();
+		std::set_difference(next.begin(), next.end(), seen.begin(), seen.end(), std::back_inserter(frontier));
+		std::vector<uint64_t> merged;
+		merged.reserve(seen.size() + frontier.size());
+		std::merge(seen.begin(), seen.end(), frontier.begin(), frontier.end(), std::back_inserter(merged));
+		seen.swap(merged);
+	}
+	return seen;
+}
+
+static std::vector<float> solve(const NarrowRules& rules, const std::vector<uint64_t>& boards, const TablebaseOptions& options, unsigned int threads) {
+	size_t num_placements = 0;
+	size_t piece_start[NUM_PIECE_TYPES + 1];
+	for (int piece = 0; piece < NUM_PIECE_TYPES; piece++) {
+		piece_start[piece] = num_placements;
+		num_placements += rules.getPlacements(piece).size();
+	}
+	piece_start[NUM_PIECE_TYPES] = num_placements;
+
+	build_clock::time_point start = build_clock::now();
+	std::vector<uint32_t> transitions(boards.size() * num_placements);
+	parallelFor(threads, boards.size(), [&](unsigned int, size_t begin, size_t end) {
+		for (size_t i = begin; i < end; i++) {
+			uint32_t* out = &transitions[i * num_placements];
+			for (int piece = 0; piece < NUM_PIECE_TYPES; piece++) {
+				for (const NarrowPlacement& placement : rules.getPlacements(piece)) {
+					NarrowDrop drop = rules.drop(boards[i], placement);
+					uint32_t next = GAME_OVER_INDEX;
+					if (!drop.game_over) {
+						next = std::lower_bound(boards.begin(), boards.end(), drop.board) - boards.begin();
+					}
+					*out++ = (next << 3) | drop.rows_cleared;
+				}
+			}
+		}
+	});
+	printf("Stored %zu transitions in %.1f s\n", transitions.size(), secondsSince(start));
+
+	start = build_clock::now();
+	std::vector<double> values(boards.size(), 0.0);
+	std::vector<double> updated(boards.size(), 0.0);
+	std::vector<double> largest_change(threads);
+	int iteration = 0;
+	for (; iteration < options.max_iterations; iteration++) {
+		parallelFor(threads, boards.size(), [&](unsigned int t, size_t begin, size_t end) {
+			double change = 0;
+			for (size_t i = begin; i < end; i++) {
+				const uint32_t* moves = &transitions[i * num_placements];
+				double total = 0;
+				for (int piece = 0; piece < NUM_PIECE_TYPES; piece++) {
+					double best = 0;
+					for (size_t k = piece_start[piece]; k < piece_start[piece + 1]; k++) {
+						uint32_t next = moves[k] >> 3;
+						double outcome = (moves[k] & 7) + ((next == GAME_OVER_INDEX) ? 0.0 : values[next]);
+						best = std::max(best, outcome);
+					}
+					total += best;
+				}
+				updated[i] = total / NUM_PIECE_TYPES;
+				change = std::max(change, std::fabs(updated[i] - values[i]));
+			}
+			largest_change[t] = change;
+		});
+		values.swap(updated);
+		double change = *std::max_element(largest_change.begin(), largest_change.end());
+		if (change <= options.tolerance) {
+			iteration++;
+			break;
+		}
+	}
+	printf("Solved in %d iterations, %.1f s: %.4f rows expected from an empty board\n", iteration, secondsSince(start), values[0]);
+	return std::vector<float>(values.begin(), values.end());
+}
+
+static bool writeTable(const char* path, const NarrowRules& rules, const std::vector<uint64_t>& boards, const std::vector<float>& values) {
+	/* Place each board in a slot with a perfect hash (see tablebase.h) and write the table. Buckets are placed
+	   largest first, each taking the first pilot that puts all of its boards in free slots.
+	*/
+	uint64_t num_slots = boards.size() + boards.size() / 32 + 1;
+	uint32_t num_buckets = (uint32_t)(boards.size() / 4 + 1);
+	std::vector<uint16_t> pilots(num_buckets);
+	std::vector<uint64_t> keys(num_slots, EMPTY_SLOT);
+	std::vector<float> slot_values(num_slots, -1.0f);
+	uint64_t seed = 0;
+
+	for (bool placed = false; !placed; seed++) {
+		std::vector<std::vector<uint32_t>> buckets(num_buckets);
+		for (uint32_t i = 0; i < boards.size(); i++) {
+			buckets[tablebase_hash(boards[i], seed) % num_buckets].push_back(i);
+		}
+		std::vector<uint32_t> order(num_buckets);
+		for (uint32_t b = 0; b < num_buckets; b++) {
+			order[b] = b;
+		}
+		std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return buckets[a].size() > buckets[b].size(); });
+
+		std::fill(keys.begin(), keys.end(), EMPTY_SLOT);
+		std::vector<uint64_t> bucket_slots;
+		placed = true;
+		for (uint32_t b : order) {
+			if (buckets[b].empty()) {
+				break;
+			}
+			bool found = false;
+			for (uint32_t pilot = 0; (pilot <= 0xFFFF) and !found; pilot++) {
+				bucket_slots.clear();
+				found = true;
+				for (uint32_t i : buckets[b]) {
+					uint64_t slot = tablebase_slot(tablebase_hash(boards[i], seed), pilot, num_slots);
+					if ((keys[slot] != EMPTY_SLOT) or (std::find(bucket_slots.begin(), bucket_slots.end(), slot) != bucket_slots.end())) {
+						found = false;
+						break;
+					}
+					bucket_slots.push_back(slot);
+				}
+				if (found) {
+					pilots[b] = pilot;
+					for (size_t j = 0; j < bucket_slots.size(); j++) {
+						keys[bucket_slots[j]] = boards[buckets[b][j]];
+						slot_values[bucket_slots[j]] = values[buckets[b][j]];
+					}
+				}
+			}
+			if (!found) {
+				// Start again with another seed
+				placed = false;
+				break;
+			}
+		}
+		if (placed) {
+			break;
+		}
+	}
+
+	uint64_t keys_offset = (TABLEBASE_HEADER_SIZE + num_buckets * sizeof(uint16_t) + 7) & ~7ULL;
+	uint64_t values_offset = keys_offset + num_slots * sizeof(uint64_t);
+	uint8_t header[TABLEBASE_HEADER_SIZE] = {};
+	uint64_t num_boards = boards.size();
+	memcpy(header, "TTBL", 4);
+	memcpy(header + 4, &TABLEBASE_VERSION, 4);
+	header[8] = (uint8_t)rules.getWidth();
+	header[9] = (uint8_t)rules.getHeight();
+	memcpy(header + 12, &num_buckets, 4);
+	memcpy(header + 16, &num_boards, 8);
+	memcpy(header + 24, &num_slots, 8);
+	memcpy(header + 32, &seed, 8);
+	memcpy(header + 40, &keys_offset, 8);
+	memcpy(header + 48, &values_offset, 8);
+
+	FILE* file = fopen(path, "wb");
+	if (file == nullptr) {
+		return false;
+	}
+	static const uint8_t padding[8] = {};
+	bool written = (fwrite(header, sizeof(header), 1, file) == 1)
+		and (fwrite(pilots.data(), sizeof(uint16_t), pilots.size(), file) == pilots.size())
+		and (fwrite(padding, 1, keys_offset - TABLEBASE_HEADER_SIZE - num_buckets * sizeof(uint16_t), file) == keys_offset - TABLEBASE_HEADER_SIZE - num_buckets * sizeof(uint16_t))
+		and (fwrite(keys.data(), sizeof(uint64_t), keys.size(), file) == keys.size())
+		and (fwrite(slot_values.data(), sizeof(float), slot_values.size(), file) == slot_values.size());
+	return (fclose(file) == 0) and written;
+}
+
+static int check(const char* path, int games) {
+	/* Play random games with the table's best placements and compare the rows cleared with the table */
+	Tablebase table;
+	if (!table.open(path)) {
+		fprintf(stderr, "Could not read table %s\n", path);
+		return 1;
+	}
+	const NarrowRules& rules = table.getRules();
+	PieceRandom random(12345);
+	uint64_t total_rows = 0;
+	uint64_t total_pieces = 0;
+	int missing = 0;
+	build_clock::time_point start = build_clock::now();
+	for (int game = 0; game < games; game++) {
+		uint64_t board = 0;
+		while (true) {
+			if (table.value(board) < 0) {
+				missing++;
+				break;
+			}
+			int piece = random.nextBelow(NUM_PIECE_TYPES);
+			NarrowDrop drop = rules.drop(board, rules.getPlacements(piece)[table.bestPlacement(board, piece)]);
+			total_rows += drop.rows_cleared;
+			total_pieces++;
+			if (drop.game_over) {
+				break;
+			}
+			board = drop.board;
+		}
+	}
+	double elapsed = secondsSince(start);
+	printf("%dx%d table with %llu boards: %.4f rows expected from an empty board\n", rules.getWidth(), rules.getHeight(),
+		(unsigned long long)table.getBoards(), table.value(0));
+	printf("Played %d games in %.2f s (%.0f placements/s): %.4f rows per game, %d reached a board missing from the table\n",
+		games, elapsed, total_pieces / elapsed, (double)total_rows / games, missing);
+	return (missing == 0) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	TablebaseOptions options;
+	const char* check_path = nullptr;
+	int games = 10000;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--width") and has_value) {
+			options.width = atoi(argv[++i]);
+		}
+		else if ((arg == "--height") and has_value) {
+			options.height = atoi(argv[++i]);
+		}
+		else if ((arg == "--out") and has_value) {
+			options.out = argv[++i];
+		}
+		else if ((arg == "--threads") and has_value) {
+			options.threads = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--tolerance") and has_value) {
+			options.tolerance = atof(argv[++i]);
+		}
+		else if ((arg == "--max-iterations") and has_value) {
+			options.max_iterations = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--check") and has_value) {
+			check_path = argv[++i];
+		}
+		else if ((arg == "--games") and has_value) {
+			games = std::max(1, atoi(argv[++i]));
+		}
+		else {
+			fprintf(stderr, "Usage: %s [--width N] [--height N] [--out FILE] [--threads N] [--tolerance F] [--max-iterations N]\n"
+				"       %s --check FILE [--games N]\n", argv[0], argv[0]);
+			return 2;
+		}
+	}
+
+	if (check_path != nullptr) {
+		return check(check_path, games);
+	}
+
+	if ((options.width < MIN_NARROW_WIDTH) or (options.width > MAX_NARROW_WIDTH) or (options.height < 1) or (options.width * options.height >= 64)) {
+		fprintf(stderr, "Boards must be %d to %d columns wide and have fewer than 64 tiles\n", MIN_NARROW_WIDTH, MAX_NARROW_WIDTH);
+		return 2;
+	}
+	if (options.out.empty()) {
+		options.out = "tablebase_" + std::to_string(options.width) + "x" + std::to_string(options.height) + ".tbl";
+	}
+	unsigned int threads = options.threads;
+	if (threads == 0) {
+		threads = std::max(1u, std::thread::hardware_concurrency());
+	}
+
+	NarrowRules rules(options.width, options.height);
+	build_clock::time_point start = build_clock::now();
+	std::vector<uint64_t> boards = reachableBoards(rules, threads);
+	printf("Found %zu reachable boards in %.1f s\n", boards.size(), secondsSince(start));
+	if (boards.size() >= GAME_OVER_INDEX) {
+		fprintf(stderr, "Too many boards to index\n");
+		return 1;
+	}
+
+	std::vector<float> values = solve(rules, boards, options, threads);
+
+	start = build_clock::now();
+	if (!writeTable(options.out.c_str(), rules, boards, values)) {
+		perror(options.out.c_str());
+		return 1;
+	}
+	printf("Wrote %s in %.1f s\n", options.out.c_str(), secondsSince(start));
+	return 0;
+}
@@ -0,0 +1,282 @@
+#pragma once
+
+/* Solved tables for narrow boards: the expected number of rows an optimal player clears from every reachable
+   position, built by tetris_tablebase (tablebase.cpp) and memory-mapped at runtime.
+
+   A narrow board is 4 to 6 columns wide and a few rows high, and is played by placement: each turn a piece is drawn
+   from the seven with equal chance, and the player picks one of its rotations (from the Shape subclasses) and a
+   column, and drops it straight down. As in Game, a piece that comes to rest with a tile above the top ends the
+   game, and full rows are removed once it locks. A board is a bitmask with row y, column x at bit y * width + x.
+
+   The file is little-endian and read in place, so it is only portable between little-endian machines:
+       0   char[4] "TTBL"
+       4   uint32  version (1)
+       8   uint8   width, uint8 height, uint16 reserved
+       12  uint32  number of hash buckets
+       16  uint64  number of boards
+       24  uint64  number of slots
+       32  uint64  hash seed
+       40  uint64  offset of the keys
+       48  uint64  offset of the values
+       56  uint64  reserved
+       64  uint16  pilot per bucket
+           uint64  board in each slot, EMPTY_SLOT for unused slots
+           float   expected rows cleared from the board in each slot
+   A board is found by hashing it to a bucket, then hashing it again with the bucket's pilot to a slot. The pilots
+   are chosen when the table is built so that no two boards share a slot, so a lookup is two hashes and one
+   comparison.
+*/
+
+#include <algorithm>
+#include <set>
+#include <vector>
+#include <stdint.h>
+#include <string.h>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "engine.h"
+
+const int MIN_NARROW_WIDTH = 4;
+const int MAX_NARROW_WIDTH = 6;
+
+const uint32_t TABLEBASE_VERSION = 1;
+const size_t TABLEBASE_HEADER_SIZE = 64;
+const uint64_t EMPTY_SLOT = ~0ULL;
+
+struct NarrowPlacement {
+	uint8_t rows[4];	// Columns the piece covers in each of its rows, from its lowest, already moved to its column
+	int height;			// Rows the piece covers
+	int rotation;		// Index into the shape's rotations
+	int x;				// Leftmost column
+};
+
+struct NarrowDrop {
+	uint64_t board;		// Board after the piece locks and full rows are removed
+	int rows_cleared;
+	bool game_over;
+};
+
+class NarrowRules {
+	/* The placements of each piece on a board of the given size, and what happens when one is dropped */
+private:
+	int width = 0;
+	int height = 0;
+	uint32_t full_row = 0;
+	std::vector<NarrowPlacement> placements[NUM_PIECE_TYPES];
+
+public:
+	NarrowRules() {}
+
+	NarrowRules(int width, int height) : width(width), height(height), full_row((1u << width) - 1) {
+		for (int piece = 0; piece < NUM_PIECE_TYPES; piece++) {
+			Shape shape = makeShape(static_cast<PieceType>(piece));
+			const std::vector<std::array<relativecoords, 4>>& rotations = shape.getRotations();
+			std::set<std::vector<uint8_t>> seen;
+			for (size_t rotation = 0; rotation < rotations.size(); rotation++) {
+				int min_x = rotations[rotation][0].relx;
+				int min_y = rotations[rotation][0].rely;
+				int max_x = min_x;
+				int max_y = min_y;
+				for (auto tile : rotations[rotation]) {
+					min_x = std::min(min_x, tile.relx);
+					min_y = std::min(min_y, tile.rely);
+					max_x = std::max(max_x, tile.relx);
+					max_y = std::max(max_y, tile.rely);
+				}
+				uint8_t rows[4] = { 0, 0, 0, 0 };
+				for (auto tile : rotations[rotation]) {
+					rows[tile.rely - min_y] |= 1 << (tile.relx - min_x);
+				}
+				// Rotations that only differ by where the reference point is give the same placements
+				if (!seen.insert(std::vector<uint8_t>(rows, rows + 4)).second) {
+					continue;
+				}
+				for (int x = 0; x + (max_x - min_x) < width; x++) {
+					NarrowPlacement placement{ { 0, 0, 0, 0 }, max_y - min_y + 1, (int)rotation, x };
+					for (int i = 0; i < 4; i++) {
+						placement.rows[i] = rows[i] << x;
+					}
+					placements[piece].push_back(placement);
+				}
+			}
+		}
+	}
+
+	int getWidth() const {
+		return width;
+	}
+
+	int getHeight() const {
+		return height;
+	}
+
+	const std::vector<NarrowPlacement>& getPlacements(int piece) const {
+		return placements[piece];
+	}
+
+	NarrowDrop drop(uint64_t board, const NarrowPlacement& placement) const {
+		/* Drop the piece from above the board until it rests on the floor or a filled tile, lock it there and clear
+		   the full rows
+		*/
+		uint32_t rows[MAX_NARROW_WIDTH * 2 + 8] = {};
+		for (int y = 0; y < height; y++) {
+			rows[y] = (board >> (y * width)) & full_row;
+		}
+		int y = height;
+		while (y > 0) {
+			uint32_t overlap = 0;
+			for (int i = 0; i < placement.height; i++) {
+				overlap |= rows[y - 1 + i] & placement.rows[i];
+			}
+			if (overlap != 0) {
+				break;
+			}
+			y--;
+		}
+
+		NarrowDrop result{ 0, 0, y + placement.height > height };
+		for (int i = 0; i < placement.height; i++) {
+			rows[y + i] |= placement.rows[i];
+		}
+		int kept = 0;
+		for (int row = 0; row < height; row++) {
+			if (rows[row] == full_row) {
+				result.rows_cleared++;
+			}
+			else {
+				result.board |= (uint64_t)rows[row] << (kept++ * width);
+			}
+		}
+		return result;
+	}
+};
+
+inline uint64_t tablebase_hash(uint64_t key, uint64_t seed) {
+	/* splitmix64's finaliser, as PieceRandom uses */
+	uint64_t z = key + seed + 0x9E3779B97F4A7C15ULL;
+	z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+	return z ^ (z >> 31);
+}
+
+inline uint64_t tablebase_slot(uint64_t hash, uint16_t pilot, uint64_t slots) {
+	return tablebase_hash(hash, pilot) % slots;
+}
+
+class Tablebase {
+	/* A solved table, mapped read-only from its file */
+private:
+	void* map = nullptr;
+	size_t map_size = 0;
+	uint32_t buckets = 0;
+	uint64_t boards = 0;
+	uint64_t slots = 0;
+	uint64_t seed = 0;
+	const uint16_t* pilots = nullptr;
+	const uint64_t* keys = nullptr;
+	const float* values = nullptr;
+	NarrowRules rules;
+
+	void close() {
+		if (map != nullptr) {
+			munmap(map, map_size);
+			map = nullptr;
+		}
+	}
+
+public:
+	Tablebase() {}
+	Tablebase(const Tablebase&) = delete;
+	Tablebase& operator=(const Tablebase&) = delete;
+
+	~Tablebase() {
+		close();
+	}
+
+	bool open(const char* path) {
+		/* Map a table built by tetris_tablebase. Returns false if it can't be read or isn't a table. */
+		close();
+		int fd = ::open(path, O_RDONLY);
+		if (fd < 0) {
+			return false;
+		}
+		struct stat info;
+		if ((fstat(fd, &info) < 0) or ((size_t)info.st_size < TABLEBASE_HEADER_SIZE)) {
+			::close(fd);
+			return false;
+		}
+		map_size = info.st_size;
+		map = mmap(nullptr, map_size, PROT_READ, MAP_SHARED, fd, 0);
+		::close(fd);
+		if (map == MAP_FAILED) {
+			map = nullptr;
+			return false;
+		}
+
+		const uint8_t* header = (const uint8_t*)map;
+		uint32_t version;
+		uint64_t keys_offset;
+		uint64_t values_offset;
+		memcpy(&version, header + 4, 4);
+		memcpy(&buckets, header + 12, 4);
+		memcpy(&boards, header + 16, 8);
+		memcpy(&slots, header + 24, 8);
+		memcpy(&seed, header + 32, 8);
+		memcpy(&keys_offset, header + 40, 8);
+		memcpy(&values_offset, header + 48, 8);
+		int width = header[8];
+		int height = header[9];
+		if ((memcmp(header, "TTBL", 4) != 0) or (version != TABLEBASE_VERSION) or (width < MIN_NARROW_WIDTH) or (width > MAX_NARROW_WIDTH)
+			or (width * height >= 64) or (slots == 0) or (buckets == 0)
+			or (TABLEBASE_HEADER_SIZE + buckets * sizeof(uint16_t) > keys_offset) or (keys_offset + slots * sizeof(uint64_t) > values_offset)
+			or (values_offset + slots * sizeof(float) > map_size)) {
+			close();
+			return false;
+		}
+		pilots = (const uint16_t*)(header + TABLEBASE_HEADER_SIZE);
+		keys = (const uint64_t*)(header + keys_offset);
+		values = (const float*)(header + values_offset);
+		rules = NarrowRules(width, height);
+		return true;
+	}
+
+	const NarrowRules& getRules() const {
+		return rules;
+	}
+
+	uint64_t getBoards() const {
+		return boards;
+	}
+
+	float value(uint64_t board) const {
+		/* Expected rows an optimal player clears from this board before the game ends, or -1 if the board can't
+		   be reached from an empty one
+		*/
+		uint64_t hash = tablebase_hash(board, seed);
+		uint64_t slot = tablebase_slot(hash, pilots[hash % buckets], slots);
+		return (keys[slot] == board) ? values[slot] : -1.0f;
+	}
+
+	int bestPlacement(uint64_t board, int piece, float* expected = nullptr) const {
+		/* Index into rules.getPlacements(piece) of the placement that clears the most rows from here on */
+		const std::vector<NarrowPlacement>& placements = rules.getPlacements(piece);
+		int best = 0;
+		float best_value = -1;
+		for (size_t i = 0; i < placements.size(); i++) {
+			NarrowDrop drop = rules.drop(board, placements[i]);
+			float outcome = drop.rows_cleared + (drop.game_over ? 0.0f : std::max(0.0f, value(drop.board)));
+			if (outcome > best_value) {
+				best_value = outcome;
+				best = i;
+			}
+		}
+		if (expected != nullptr) {
+			*expected = best_value;
+		}
+		return best;
+	}
+};
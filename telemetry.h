@@ -0,0 +1,249 @@
+#pragma once
+
+/* Frame-time and input-latency telemetry.
+
+   Three things are measured, in microseconds:
+     - frame time:      time between consecutive buffer swaps
+     - input latency:   time from a keyboard() event to the first buffer swap after it
+     - gravity latency: time from a gravity() tick that moved the game to the buffer swap showing it
+
+   Each is kept in a log-linear (HDR-style) histogram of fixed size, so memory stays constant however long the
+   game runs. Once per report interval the percentiles are saved for the on-screen overlay and, when a stream is
+   open, appended to it as CSV or as fixed-size binary records.
+*/
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <initializer_list>
+#include <stdint.h>
+
+class LatencyHistogram {
+	/* Histogram with 32 linear buckets per power of two, giving about 3% precision from 1us to ~35 minutes */
+private:
+	static const int SUB_BUCKET_BITS = 5;
+	static const int HALF_SUB_BUCKETS = 1 << (SUB_BUCKET_BITS - 1);
+	static const int MAX_VALUE_BITS = 31;
+	static const int NUM_BUCKETS = (MAX_VALUE_BITS - SUB_BUCKET_BITS + 2) * HALF_SUB_BUCKETS;
+
+	uint32_t counts[NUM_BUCKETS];
+	uint64_t total = 0;
+	int64_t max_value = 0;
+
+	static int bucketIndex(int64_t value) {
+		int msb = 63 - __builtin_clzll(value | 1);
+		if (msb < SUB_BUCKET_BITS) {
+			return (int)value;
+		}
+		int shift = msb - SUB_BUCKET_BITS + 1;
+		return (shift * HALF_SUB_BUCKETS) + (int)(value >> shift);
+	}
+
+	static int64_t bucketValue(int index) {
+		/* Returns the highest value that falls into the given bucket */
+		if (index < (2 * HALF_SUB_BUCKETS)) {
+			return index;
+		}
+		int shift = (index / HALF_SUB_BUCKETS) - 1;
+		int64_t sub_bucket = index - (shift * HALF_SUB_BUCKETS);
+		return ((sub_bucket + 1) << shift) - 1;
+	}
+
+public:
+	LatencyHistogram() {
+		reset();
+	}
+
+	void record(int64_t value) {
+		if (value < 0) {
+			value = 0;
+		}
+		else if (value >= (int64_t(1) << MAX_VALUE_BITS)) {
+			value = (int64_t(1) << MAX_VALUE_BITS) - 1;
+		}
+		counts[bucketIndex(value)]++;
+		total++;
+		if (value > max_value) {
+			max_value = value;
+		}
+	}
+
+	int64_t percentile(double p) const {
+		/* Returns the value at or below which p percent of the recorded values lie, 0 if nothing was recorded */
+		if (total == 0) {
+			return 0;
+		}
+		uint64_t wanted = (uint64_t)((p / 100.0) * total + 0.5);
+		if (wanted < 1) {
+			wanted = 1;
+		}
+		uint64_t seen = 0;
+		for (int i = 0; i < NUM_BUCKETS; i++) {
+			seen += counts[i];
+			if (seen >= wanted) {
+				int64_t value = bucketValue(i);
+				return (value < max_value) ? value : max_value;
+			}
+		}
+		return max_value;
+	}
+
+	int64_t max() const {
+		return max_value;
+	}
+
+	uint64_t count() const {
+		return total;
+	}
+
+	void reset() {
+		memset(counts, 0, sizeof(counts));
+		total = 0;
+		max_value = 0;
+	}
+};
+
+// Percentiles of one histogram over a report interval, in microseconds
+struct LatencySummary {
+	uint64_t count;
+	int64_t p50;
+	int64_t p99;
+	int64_t max;
+};
+
+// Fixed-size record written to a binary stream, one per report interval
+struct TelemetryRecord {
+	double time_s;
+	LatencySummary frame;
+	LatencySummary input;
+	LatencySummary gravity;
+};
+
+class Telemetry {
+private:
+	typedef std::chrono::steady_clock clock;
+
+	// Events waiting for the buffer swap that shows them. Anything beyond this many per frame is not measured.
+	static const int MAX_PENDING = 32;
+
+	clock::time_point start = clock::now();
+	clock::time_point interval_start = start;
+	clock::time_point last_swap;
+	bool swapped = false;
+
+	clock::time_point pending_input[MAX_PENDING];
+	int num_pending_input = 0;
+	clock::time_point pending_gravity;
+	bool gravity_pending = false;
+
+	LatencyHistogram frame_times;
+	LatencyHistogram input_latency;
+	LatencyHistogram gravity_latency;
+
+	FILE* stream = nullptr;
+	bool binary_stream = false;
+
+	static int64_t micros(clock::duration d) {
+		return std::chrono::duration_cast<std::chrono::microseconds>(d).count();
+	}
+
+	static LatencySummary summarise(const LatencyHistogram& histogram) {
+		return LatencySummary{ histogram.count(), histogram.percentile(50), histogram.percentile(99), histogram.max() };
+	}
+
+	void endInterval(clock::time_point now) {
+		/* Save this interval's percentiles, write them to the stream and start a new interval */
+		last.time_s = std::chrono::duration<double>(now - start).count();
+		last.frame = summarise(frame_times);
+		last.input = summarise(input_latency);
+		last.gravity = summarise(gravity_latency);
+
+		if (stream != nullptr) {
+			if (binary_stream) {
+				fwrite(&last, sizeof(last), 1, stream);
+			}
+			else {
+				fprintf(stream, "%.3f", last.time_s);
+				for (const LatencySummary* s : { &last.frame, &last.input, &last.gravity }) {
+					fprintf(stream, ",%llu,%.3f,%.3f,%.3f", (unsigned long long)s->count, s->p50 / 1000.0, s->p99 / 1000.0, s->max / 1000.0);
+				}
+				fprintf(stream, "\n");
+			}
+			fflush(stream);
+		}
+
+		frame_times.reset();
+		input_latency.reset();
+		gravity_latency.reset();
+		interval_start = now;
+	}
+
+public:
+	// Length of each report interval
+	clock::duration interval = std::chrono::seconds(1);
+
+	// Percentiles from the last completed interval, shown by the overlay
+	TelemetryRecord last{};
+
+	~Telemetry() {
+		if (stream != nullptr) {
+			fclose(stream);
+		}
+	}
+
+	bool openStream(const char* path) {
+		/* Start streaming one record per interval to path. Files ending in .bin get binary TelemetryRecords,
+		   anything else gets CSV with times in milliseconds. Returns false if the file can't be opened.
+		*/
+		size_t len = strlen(path);
+		binary_stream = (len >= 4) && (strcmp(path + len - 4, ".bin") == 0);
+		stream = fopen(path, binary_stream ? "wb" : "w");
+		if ((stream != nullptr) && !binary_stream) {
+			fprintf(stream, "time_s");
+			for (const char* name : { "frame", "input", "gravity" }) {
+				fprintf(stream, ",%s_count,%s_p50_ms,%s_p99_ms,%s_max_ms", name, name, name, name);
+			}
+			fprintf(stream, "\n");
+		}
+		return stream != nullptr;
+	}
+
+	void inputReceived() {
+		/* Call at the start of keyboard() */
+		if (num_pending_input < MAX_PENDING) {
+			pending_input[num_pending_input++] = clock::now();
+		}
+	}
+
+	void gravityTicked() {
+		/* Call when a gravity() tick moves the game and needs a redraw */
+		if (!gravity_pending) {
+			pending_gravity = clock::now();
+			gravity_pending = true;
+		}
+	}
+
+	void frameSwapped() {
+		/* Call straight after glutSwapBuffers() */
+		clock::time_point now = clock::now();
+		if (swapped) {
+			frame_times.record(micros(now - last_swap));
+		}
+		last_swap = now;
+		swapped = true;
+
+		for (int i = 0; i < num_pending_input; i++) {
+			input_latency.record(micros(now - pending_input[i]));
+		}
+		num_pending_input = 0;
+
+		if (gravity_pending) {
+			gravity_latency.record(micros(now - pending_gravity));
+			gravity_pending = false;
+		}
+
+		if (now - interval_start >= interval) {
+			endInterval(now);
+		}
+	}
+};
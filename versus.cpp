@@ -0,0 +1,632 @@
+/* Versus games between bots, run in lockstep with rollback (versus.h).
+
+   Usage: tetris_versus [options]
+     --players N        boards in the match, 2 to 8 (default: 2)
+     --seed N           seed of the first match, match i uses seed + i (default: 1)
+     --matches N        matches to play one after another (default: 1)
+     --latency N        ticks an input takes to reach the other peers (default: 3)
+     --jitter N         up to this many ticks more, drawn for each input sent (default: 2)
+     --think N          ticks a bot waits between actions, plus up to as many again at random (default: 2)
+     --max-ticks N      stop a match that runs this long and call it a draw (default: 20000)
+     --listen PATH      play player 0 of a two-player match against the process that connects to the Unix socket PATH
+     --connect PATH     play player 1 against the process listening at PATH
+     --tick-ms N        milliseconds per tick over a socket (default: 50, 0 runs as fast as both peers can)
+     --check            play a fixed set of in-process matches instead: two players, four players with heavy jitter,
+                        and one stopped by --max-ticks as a draw while inputs are still in flight
+
+   Without --listen or --connect every player is a peer in this process with its own RollbackSession, and each
+   input it sends is delivered to the others after --latency plus up to --jitter ticks. Once a match is over, each
+   peer's checksums of the confirmed states are compared with the others', and the final state is compared with a
+   straight run of the same inputs with no rollback.
+
+   Over a socket the peers exchange only messages framed as in protocol.h:
+       HELLO     uint64 seed, uint32 max ticks        from the listener when the other side connects
+       INPUT     uint8 player, uint32 tick, uint8 input
+       CHECKSUM  uint32 tick, uint64 checksum         every CHECKSUM_INTERVAL confirmed ticks
+       DONE      uint32 tick, uint64 checksum         the tick the match ended at, and the state there
+   and the connecting side's --latency and --jitter apply to what it sends. A peer exits with 1 if a checksum
+   differs from the other's.
+*/
+
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <string>
+#include <string.h>
+#include <vector>
+
+#include <fcntl.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "engine.h"
+#include "planner.h"
+#include "protocol.h"
+#include "versus.h"
+
+typedef std::chrono::steady_clock versus_clock;
+
+enum class VersusMessage : uint8_t { HELLO = 1, INPUT = 2, CHECKSUM = 3, DONE = 4 };
+
+struct VersusOptions {
+	int players = 2;
+	uint64_t seed = 1;
+	int matches = 1;
+	uint32_t latency = 3;
+	uint32_t jitter = 2;
+	uint32_t think = 2;
+	uint32_t max_ticks = 20000;
+	uint32_t tick_ms = 50;
+};
+
+class VersusBot {
+	/* Plays one board with the placement policy in planner.h, one action every few ticks */
+private:
+	PieceRandom random;
+	uint32_t think;
+	uint32_t planned_piece = UINT32_MAX;
+	Placement target{ 0, 0 };
+	bool slammed = false;
+	uint32_t next_action = 0;
+
+public:
+	VersusBot(uint64_t seed, uint32_t think) : random(seed), think(think) {}
+
+	VersusInput decide(const Game& game, uint32_t tick) {
+		if (game.isGameOver()) {
+			return 0;
+		}
+		if (game.getPiecesPlaced() != planned_piece) {
+			planned_piece = game.getPiecesPlaced();
+			target = planPlacement(game);
+			slammed = false;
+		}
+		if (slammed or (tick < next_action)) {
+			return 0;
+		}
+		Action action = actionTowards(game, target);
+		slammed = (action == Action::SLAM);
+		next_action = tick + think + random.nextBelow(think + 1);
+		return versusInput(action);
+	}
+};
+
+struct PeerTimings {
+	uint64_t advances = 0;
+	uint64_t stalls = 0;
+	double total_us = 0;
+	double worst_us = 0;
+
+	void add(double us) {
+		advances++;
+		total_us += us;
+		worst_us = std::max(worst_us, us);
+	}
+};
+
+static void printMatch(const VersusMatch& match, uint32_t ticks, int winner) {
+	if (winner >= 0) {
+		printf("Player %d won after %u ticks\n", winner, ticks);
+	}
+	else {
+		printf("No winner after %u ticks\n", ticks);
+	}
+	printf("%6s %8s %6s %6s %8s %8s\n", "player", "score", "rows", "pieces", "sent", "taken");
+	for (int player = 0; player < match.getPlayers(); player++) {
+		const Game& game = match.getGame(player);
+		printf("%6d %8d %6d %6u %8d %8d\n", player, game.getScore(), game.getRowsCleared(), game.getPiecesPlaced(),
+			match.getGarbageSent(player), match.getGarbageReceived(player));
+	}
+}
+
+static void printSessionStats(const RollbackSession& session, const PeerTimings& timings, const char* name) {
+	printf("%s: %llu ticks, %llu rollbacks (deepest %u), %llu resimulated, %llu stalls, advance %.1f us mean %.1f us worst\n",
+		name, (unsigned long long)timings.advances, (unsigned long long)session.getRollbacks(), session.getDeepestRollback(),
+		(unsigned long long)session.getResimulatedTicks(), (unsigned long long)timings.stalls,
+		timings.total_us / std::max<uint64_t>(1, timings.advances), timings.worst_us);
+}
+
+static bool isFinished(const RollbackSession& session, uint32_t max_ticks) {
+	return session.isConfirmedOver() or (session.getConfirmedTick() >= max_ticks);
+}
+
+static int playInProcess(const VersusOptions& options, uint64_t seed) {
+	/* Every player a peer in this process, inputs passed through delayed queues */
+	struct Delivery {
+		uint32_t at;
+		int player;
+		uint32_t tick;
+		VersusInput input;
+	};
+
+	int players = options.players;
+	std::vector<RollbackSession> sessions;
+	std::vector<VersusBot> bots;
+	std::vector<std::vector<Delivery>> queues(players);
+	std::vector<std::vector<VersusInput>> sent(players);
+	std::vector<std::vector<VersusChecksum>> checksums(players);
+	std::vector<PeerTimings> timings(players);
+	sessions.reserve(players);
+	for (int player = 0; player < players; player++) {
+		sessions.emplace_back(players, seed);
+		bots.emplace_back(seed * MAX_VERSUS_PLAYERS + player, options.think);
+	}
+	PieceRandom network(seed ^ 0x5DEECE66DULL);
+	int rejected = 0;
+	bool stuck = false;
+
+	for (uint32_t now = 0; ; now++) {
+		bool all_finished = true;
+		bool progressed = false;
+		for (int player = 0; player < players; player++) {
+			RollbackSession& session = sessions[player];
+			std::vector<Delivery>& queue = queues[player];
+			size_t kept = 0;
+			for (const Delivery& delivery : queue) {
+				if (delivery.at > now) {
+					queue[kept++] = delivery;
+				}
+				else if (!session.setInput(delivery.player, delivery.tick, delivery.input)) {
+					rejected++;
+				}
+			}
+			progressed |= (kept != queue.size());
+			queue.resize(kept);
+			session.confirm();
+			std::vector<VersusChecksum> confirmed = session.takeChecksums();
+			checksums[player].insert(checksums[player].end(), confirmed.begin(), confirmed.end());
+
+			if (isFinished(session, options.max_ticks)) {
+				continue;
+			}
+			all_finished = false;
+			if (session.getTick() >= options.max_ticks) {
+				continue;
+			}
+			if (!session.canAdvance()) {
+				timings[player].stalls++;
+				continue;
+			}
+			uint32_t tick = session.getTick();
+			VersusInput input = bots[player].decide(session.getMatch().getGame(player), tick);
+			session.setInput(player, tick, input);
+			sent[player].push_back(input);
+			progressed = true;
+			for (int other = 0; other < players; other++) {
+				if (other != player) {
+					queues[other].push_back(Delivery{ now + options.latency + network.nextBelow(options.jitter + 1), player, tick, input });
+				}
+			}
+			versus_clock::time_point start = versus_clock::now();
+			session.advance();
+			timings[player].add(std::chrono::duration<double, std::micro>(versus_clock::now() - start).count());
+			std::vector<VersusChecksum> taken = session.takeChecksums();
+			checksums[player].insert(checksums[player].end(), taken.begin(), taken.end());
+		}
+		if (all_finished) {
+			break;
+		}
+		if (!progressed and std::all_of(queues.begin(), queues.end(), [](const std::vector<Delivery>& queue) { return queue.empty(); })) {
+			// A peer that saw the match end stops sending inputs, so one that didn't can never catch up
+			printf("Peers stopped at different ticks\n");
+			stuck = true;
+			break;
+		}
+	}
+
+	// Every peer has to agree on each confirmed state, the end of the match, and its outcome
+	int mismatches = rejected + (stuck ? 1 : 0);
+	size_t compared = 0;
+	for (int player = 1; player < players; player++) {
+		size_t count = std::min(checksums[0].size(), checksums[player].size());
+		for (size_t i = 0; i < count; i++) {
+			compared++;
+			if ((checksums[0][i].tick != checksums[player][i].tick) or (checksums[0][i].checksum != checksums[player][i].checksum)) {
+				printf("Peer %d differs from peer 0 at tick %u\n", player, checksums[player][i].tick);
+				mismatches++;
+				break;
+			}
+		}
+		if ((sessions[player].getConfirmedTick() != sessions[0].getConfirmedTick())
+			or (sessions[player].getConfirmedMatch().checksum() != sessions[0].getConfirmedMatch().checksum())
+			or (sessions[player].getWinner() != sessions[0].getWinner())) {
+			printf("Peer %d ended differently from peer 0\n", player);
+			mismatches++;
+		}
+	}
+
+	// And the state they agree on must be the one the inputs give with no predictions at all
+	uint32_t end_tick = sessions[0].getConfirmedTick();
+	VersusMatch straight(players, seed);
+	std::vector<VersusInput> inputs(players);
+	for (uint32_t tick = 0; tick < end_tick; tick++) {
+		for (int player = 0; player < players; player++) {
+			inputs[player] = sent[player][tick];
+		}
+		straight.step(inputs.data());
+	}
+	if (straight.checksum() != sessions[0].getConfirmedMatch().checksum()) {
+		printf("Peers agree but differ from a straight run of the same inputs\n");
+		mismatches++;
+	}
+
+	printMatch(straight, end_tick, sessions[0].getWinner());
+	PeerTimings all;
+	RollbackSession* deepest = &sessions[0];
+	uint64_t rollbacks = 0;
+	uint64_t resimulated = 0;
+	for (int player = 0; player < players; player++) {
+		all.advances += timings[player].advances;
+		all.stalls += timings[player].stalls;
+		all.total_us += timings[player].total_us;
+		all.worst_us = std::max(all.worst_us, timings[player].worst_us);
+		rollbacks += sessions[player].getRollbacks();
+		resimulated += sessions[player].getResimulatedTicks();
+		if (sessions[player].getDeepestRollback() > deepest->getDeepestRollback()) {
+			deepest = &sessions[player];
+		}
+	}
+	printf("%d peers: %llu ticks, %llu rollbacks (deepest %u), %llu resimulated, %llu stalls, advance %.1f us mean %.1f us worst\n",
+		players, (unsigned long long)all.advances, (unsigned long long)rollbacks, deepest->getDeepestRollback(),
+		(unsigned long long)resimulated, (unsigned long long)all.stalls, all.total_us / std::max<uint64_t>(1, all.advances), all.worst_us);
+	printf("Compared %zu checksums: %s\n", compared, (mismatches == 0) ? "all peers in step" : "DESYNC");
+	return (mismatches == 0) ? 0 : 1;
+}
+
+static int openSocket(const char* path, bool listening) {
+	/* Listen at path and accept one peer, or connect to a peer listening there, waiting up to 10 seconds for it */
+	sockaddr_un address{};
+	address.sun_family = AF_UNIX;
+	strncpy(address.sun_path, path, sizeof(address.sun_path) - 1);
+	int fd = -1;
+	if (listening) {
+		int listener = socket(AF_UNIX, SOCK_STREAM, 0);
+		unlink(path);
+		if ((listener < 0) or (bind(listener, (sockaddr*)&address, sizeof(address)) < 0) or (listen(listener, 1) < 0)) {
+			return -1;
+		}
+		printf("Waiting for a peer on %s\n", path);
+		fd = accept(listener, nullptr, nullptr);
+		close(listener);
+		unlink(path);
+	}
+	else {
+		versus_clock::time_point give_up = versus_clock::now() + std::chrono::seconds(10);
+		while (true) {
+			fd = socket(AF_UNIX, SOCK_STREAM, 0);
+			if ((fd >= 0) and (connect(fd, (sockaddr*)&address, sizeof(address)) == 0)) {
+				break;
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+			fd = -1;
+			if (versus_clock::now() > give_up) {
+				break;
+			}
+			usleep(50000);
+		}
+	}
+	if (fd >= 0) {
+		fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+	}
+	return fd;
+}
+
+static bool pump(int fd, std::string& in, std::string& out) {
+	/* Send what is queued and read what has arrived. Returns false once the peer has gone. */
+	while (!out.empty()) {
+		ssize_t sent = send(fd, out.data(), out.size(), MSG_NOSIGNAL);
+		if (sent > 0) {
+			out.erase(0, sent);
+		}
+		else if ((errno == EAGAIN) or (errno == EWOULDBLOCK) or (errno == EINTR)) {
+			break;
+		}
+		else {
+			return false;
+		}
+	}
+	char buffer[65536];
+	while (true) {
+		ssize_t received = recv(fd, buffer, sizeof(buffer), 0);
+		if (received > 0) {
+			in.append(buffer, received);
+		}
+		else if ((received < 0) and ((errno == EAGAIN) or (errno == EWOULDBLOCK) or (errno == EINTR))) {
+			return true;
+		}
+		else {
+			return false;
+		}
+	}
+}
+
+static int playOverSocket(VersusOptions options, const char* path, bool listening) {
+	/* Two processes, one player each, in step over a Unix socket */
+	int fd = openSocket(path, listening);
+	if (fd < 0) {
+		perror(path);
+		return 1;
+	}
+	int local = listening ? 0 : 1;
+	int remote = 1 - local;
+	std::string in;
+	std::string out;
+	if (listening) {
+		MessageWriter(out).begin((uint8_t)VersusMessage::HELLO).u64(options.seed).u32(options.max_ticks).end();
+	}
+
+	struct Outgoing {
+		uint32_t at;
+		uint32_t tick;
+		VersusInput input;
+	};
+	std::vector<Outgoing> delayed;
+	PieceRandom network(options.seed ^ 0x5DEECE66DULL ^ local);
+	RollbackSession* session = nullptr;
+	VersusBot* bot = nullptr;
+	PeerTimings timings;
+	std::map<uint32_t, uint64_t> local_checksums;
+	std::map<uint32_t, uint64_t> remote_checksums;
+	bool done_sent = false;
+	bool done_received = false;
+	VersusChecksum remote_done{ 0, 0 };
+	int mismatches = 0;
+	size_t compared = 0;
+
+	auto compare = [&](uint32_t tick) {
+		auto mine = local_checksums.find(tick);
+		auto theirs = remote_checksums.find(tick);
+		if ((mine != local_checksums.end()) and (theirs != remote_checksums.end())) {
+			compared++;
+			if (mine->second != theirs->second) {
+				printf("Checksums differ at tick %u\n", tick);
+				mismatches++;
+			}
+			local_checksums.erase(mine);
+			remote_checksums.erase(theirs);
+		}
+	};
+
+	// The connecting side starts once HELLO has told it the seed, which comes before any input
+	auto start = [&]() {
+		if (session == nullptr) {
+			session = new RollbackSession(2, options.seed);
+			bot = new VersusBot(options.seed * MAX_VERSUS_PLAYERS + local, options.think);
+			printf("Playing player %d of match %llu\n", local, (unsigned long long)options.seed);
+		}
+	};
+	if (listening) {
+		start();
+	}
+
+	versus_clock::time_point next_tick = versus_clock::now();
+	for (uint32_t now = 0; !(done_sent and done_received); ) {
+		if (!pump(fd, in, out)) {
+			fprintf(stderr, "The peer closed the connection\n");
+			break;
+		}
+		size_t offset = 0;
+		uint8_t type;
+		MessageReader body(nullptr, 0);
+		while (nextFrame(in, offset, type, body)) {
+			switch ((VersusMessage)type) {
+			case VersusMessage::HELLO:
+				options.seed = body.u64();
+				options.max_ticks = body.u32();
+				start();
+				break;
+			case VersusMessage::INPUT: {
+				int player = body.u8();
+				uint32_t tick = body.u32();
+				VersusInput input = body.u8();
+				if ((session != nullptr) and ((player != remote) or !session->setInput(player, tick, input))) {
+					printf("Bad input from the peer for player %d at tick %u\n", player, tick);
+					mismatches++;
+				}
+				break;
+			}
+			case VersusMessage::CHECKSUM: {
+				uint32_t tick = body.u32();
+				remote_checksums[tick] = body.u64();
+				compare(tick);
+				break;
+			}
+			case VersusMessage::DONE:
+				remote_done.tick = body.u32();
+				remote_done.checksum = body.u64();
+				done_received = true;
+				break;
+			}
+		}
+		in.erase(0, offset);
+		auto sendChecksums = [&]() {
+			for (const VersusChecksum& checksum : session->takeChecksums()) {
+				MessageWriter(out).begin((uint8_t)VersusMessage::CHECKSUM).u32(checksum.tick).u64(checksum.checksum).end();
+				local_checksums[checksum.tick] = checksum.checksum;
+				compare(checksum.tick);
+			}
+		};
+		if (session != nullptr) {
+			// Inputs that just arrived can confirm ticks even when this side isn't advancing
+			session->confirm();
+			sendChecksums();
+		}
+
+		bool advanced = false;
+		if ((session != nullptr) and (versus_clock::now() >= next_tick)) {
+			next_tick += std::chrono::milliseconds(options.tick_ms);
+			now++;
+			size_t kept = 0;
+			for (const Outgoing& message : delayed) {
+				if (message.at > now) {
+					delayed[kept++] = message;
+				}
+				else {
+					MessageWriter(out).begin((uint8_t)VersusMessage::INPUT).u8(local).u32(message.tick).u8(message.input).end();
+				}
+			}
+			delayed.resize(kept);
+
+			if (isFinished(*session, options.max_ticks)) {
+				if (!done_sent and delayed.empty()) {
+					MessageWriter(out).begin((uint8_t)VersusMessage::DONE).u32(session->getConfirmedTick())
+						.u64(session->getConfirmedMatch().checksum()).end();
+					done_sent = true;
+				}
+			}
+			else if (session->getTick() >= options.max_ticks) {
+				// Waiting for the peer's inputs to confirm the end
+			}
+			else if (!session->canAdvance()) {
+				timings.stalls++;
+				if (done_received) {
+					// The peer has sent every input it will and saw the match end, this side can't get there
+					printf("The peer finished at tick %u, which this side can't reach\n", remote_done.tick);
+					mismatches++;
+					break;
+				}
+			}
+			else {
+				advanced = true;
+				uint32_t tick = session->getTick();
+				VersusInput input = bot->decide(session->getMatch().getGame(local), tick);
+				session->setInput(local, tick, input);
+				uint32_t delay = listening ? 0 : options.latency + network.nextBelow(options.jitter + 1);
+				delayed.push_back(Outgoing{ now + delay, tick, input });
+				versus_clock::time_point start = versus_clock::now();
+				session->advance();
+				timings.add(std::chrono::duration<double, std::micro>(versus_clock::now() - start).count());
+				sendChecksums();
+			}
+		}
+		if (advanced and (options.tick_ms == 0)) {
+			continue;
+		}
+		pollfd waiting{ fd, (short)(POLLIN | (out.empty() ? 0 : POLLOUT)), 0 };
+		int wait_ms = (session == nullptr) ? 50 : (int)std::chrono::duration_cast<std::chrono::milliseconds>(next_tick - versus_clock::now()).count();
+		poll(&waiting, 1, std::max(0, std::min(wait_ms, 50)));
+	}
+	// Let the last of what is queued go out before closing
+	for (int i = 0; (i < 100) and !out.empty() and pump(fd, in, out); i++) {
+		usleep(1000);
+	}
+	close(fd);
+
+	if (session == nullptr) {
+		fprintf(stderr, "The match never started\n");
+		return 1;
+	}
+	if (!done_received or !done_sent) {
+		mismatches++;
+	}
+	else if ((remote_done.tick != session->getConfirmedTick()) or (remote_done.checksum != session->getConfirmedMatch().checksum())) {
+		printf("The match ended at tick %u here and tick %u for the peer, or in a different state\n", session->getConfirmedTick(),
+			remote_done.tick);
+		mismatches++;
+	}
+	else {
+		compared++;
+	}
+	printMatch(session->getConfirmedMatch(), session->getConfirmedTick(), session->getWinner());
+	printSessionStats(*session, timings, "This peer");
+	printf("Compared %zu checksums: %s\n", compared, (mismatches == 0) ? "in step with the peer" : "DESYNC");
+	delete bot;
+	delete session;
+	return (mismatches == 0) ? 0 : 1;
+}
+
+int main(int argc, char* argv[]) {
+	VersusOptions options;
+	const char* listen_path = nullptr;
+	const char* connect_path = nullptr;
+	bool check = false;
+	bool usage = false;
+
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		bool has_value = (i + 1 < argc);
+		if ((arg == "--players") and has_value) {
+			options.players = std::max(2, std::min(atoi(argv[++i]), MAX_VERSUS_PLAYERS));
+		}
+		else if ((arg == "--seed") and has_value) {
+			options.seed = strtoull(argv[++i], nullptr, 10);
+		}
+		else if ((arg == "--matches") and has_value) {
+			options.matches = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--latency") and has_value) {
+			options.latency = std::max(0, atoi(argv[++i]));
+		}
+		else if ((arg == "--jitter") and has_value) {
+			options.jitter = std::max(0, atoi(argv[++i]));
+		}
+		else if ((arg == "--think") and has_value) {
+			options.think = std::max(0, atoi(argv[++i]));
+		}
+		else if ((arg == "--max-ticks") and has_value) {
+			options.max_ticks = std::max(1, atoi(argv[++i]));
+		}
+		else if ((arg == "--tick-ms") and has_value) {
+			options.tick_ms = std::max(0, atoi(argv[++i]));
+		}
+		else if ((arg == "--listen") and has_value) {
+			listen_path = argv[++i];
+		}
+		else if ((arg == "--connect") and has_value) {
+			connect_path = argv[++i];
+		}
+		else if (arg == "--check") {
+			check = true;
+		}
+		else {
+			usage = true;
+			break;
+		}
+	}
+	if (usage or ((listen_path != nullptr) and (connect_path != nullptr))) {
+		fprintf(stderr, "Usage: %s [--players N] [--seed N] [--matches N] [--latency N] [--jitter N] [--think N] [--max-ticks N]\n"
+			"       %s --check\n"
+			"       %s --listen PATH | --connect PATH [--seed N] [--tick-ms N] [--latency N] [--jitter N] [--think N]\n", argv[0], argv[0], argv[0]);
+		return 2;
+	}
+
+	if (listen_path != nullptr) {
+		return playOverSocket(options, listen_path, true);
+	}
+	if (connect_path != nullptr) {
+		return playOverSocket(options, connect_path, false);
+	}
+	int failures = 0;
+	if (check) {
+		/* Each case ends with the peers' confirmed states compared, so a session that can't confirm its last
+		   ticks shows up as a failure here rather than a hang over a socket
+		*/
+		VersusOptions four = options;
+		four.players = 4;
+		four.latency = 6;
+		four.jitter = 6;
+		VersusOptions draw = options;
+		draw.max_ticks = 100;
+		draw.latency = 5;
+		for (const VersusOptions& match : { options, four, draw }) {
+			printf("%d players, latency %u, jitter %u, max ticks %u\n", match.players, match.latency, match.jitter,
+				match.max_ticks);
+			failures += playInProcess(match, match.seed);
+		}
+		return (failures == 0) ? 0 : 1;
+	}
+	for (int match = 0; match < options.matches; match++) {
+		if (options.matches > 1) {
+			printf("Match %d, seed %llu\n", match + 1, (unsigned long long)(options.seed + match));
+		}
+		failures += playInProcess(options, options.seed + match);
+	}
+	return (failures == 0) ? 0 : 1;
+}
@@ -0,0 +1,387 @@
+#pragma once
+
+/* Versus games between 2 to MAX_VERSUS_PLAYERS boards, run in deterministic lockstep.
+
+   A VersusMatch is a Game per player and the garbage passing between them. Every board is seeded with the match
+   seed, so all players get the same pieces. Each tick every player's input is applied and its game ticked; a player
+   that clears 2, 3 or 4 rows at once sends GARBAGE_FOR_CLEAR rows to the next player still in the game, after first
+   cancelling garbage waiting for itself. Garbage waiting for a player goes in under its board (Game::addGarbage, one
+   shift for all the rows) the next time its piece locks, with a hole in a column drawn from the match's own random
+   sequence. The last player left wins.
+
+   Nothing outside the inputs decides what happens: no clocks, no floating point, no unordered containers. So peers
+   only send each other their inputs, and any peer that applies the same inputs reaches the same state, which
+   checksum() lets them check.
+
+   RollbackSession runs a match on one peer without waiting for the others. An input that hasn't arrived for a tick
+   is predicted to be no input, and the tick goes ahead. The state before each of the last MAX_ROLLBACK_TICKS ticks
+   is kept, and when an input arrives that differs from the prediction, the state before its tick is restored and
+   the ticks since are simulated again with it. A session stops advancing when it is MAX_ROLLBACK_TICKS ahead of the
+   inputs it has from every player. A tick of a match with every board near the top costs a few microseconds, so
+   resimulating a whole window stays far inside a 50ms frame.
+*/
+
+#include <algorithm>
+#include <vector>
+#include <stdint.h>
+
+#include "engine.h"
+
+const int MAX_VERSUS_PLAYERS = 8;
+
+// Garbage rows sent by clearing 0 to 4 rows at once
+const int GARBAGE_FOR_CLEAR[5] = { 0, 0, 1, 2, 4 };
+
+// A player's input for one tick: bit i set for each Action i to apply, applied in Action order before the tick
+typedef uint8_t VersusInput;
+
+inline VersusInput versusInput(Action action) {
+	return (VersusInput)(1 << static_cast<int>(action));
+}
+
+class VersusMatch {
+private:
+	int players = 2;
+	Game games[MAX_VERSUS_PLAYERS];
+	PieceRandom garbage_random;
+	uint32_t tick = 0;
+
+	// Garbage rows waiting to go in under each board, and the totals each player has sent and taken
+	int pending_garbage[MAX_VERSUS_PLAYERS] = {};
+	int garbage_sent[MAX_VERSUS_PLAYERS] = {};
+	int garbage_received[MAX_VERSUS_PLAYERS] = {};
+
+	int nextAlive(int player) const {
+		/* The player after this one, in order, whose game isn't over. Returns player itself if there is none. */
+		for (int i = 1; i < players; i++) {
+			int other = (player + i) % players;
+			if (!games[other].isGameOver()) {
+				return other;
+			}
+		}
+		return player;
+	}
+
+public:
+	VersusMatch(int players = 2, uint64_t seed = 0) : players(std::max(1, std::min(players, MAX_VERSUS_PLAYERS))),
+		garbage_random(seed ^ 0x9E3779B97F4A7C15ULL) {
+		for (int i = 0; i < this->players; i++) {
+			games[i] = Game(seed);
+		}
+	}
+
+	void copyFrom(const VersusMatch& other) {
+		/* Copy only the boards in play, snapshots are taken every tick */
+		players = other.players;
+		std::copy(other.games, other.games + players, games);
+		garbage_random = other.garbage_random;
+		tick = other.tick;
+		std::copy(other.pending_garbage, other.pending_garbage + players, pending_garbage);
+		std::copy(other.garbage_sent, other.garbage_sent + players, garbage_sent);
+		std::copy(other.garbage_received, other.garbage_received + players, garbage_received);
+	}
+
+	void step(const VersusInput inputs[]) {
+		/* Advance every board by one tick with the given inputs, one per player. Attacks are settled once every
+		   board has moved, so the order players are stepped in doesn't change what they send or take.
+		*/
+		PROFILE_SCOPE("versusStep");
+		int attack[MAX_VERSUS_PLAYERS] = {};
+		bool locked[MAX_VERSUS_PLAYERS] = {};
+		for (int player = 0; player < players; player++) {
+			Game& game = games[player];
+			if (game.isGameOver()) {
+				continue;
+			}
+			uint32_t clears = game.getClears();
+			uint32_t pieces = game.getPiecesPlaced();
+			for (int action = 0; action < NUM_ACTIONS; action++) {
+				if (inputs[player] & (1 << action)) {
+					game.apply(static_cast<Action>(action));
+				}
+			}
+			game.tick();
+			if (game.getClears() != clears) {
+				attack[player] = GARBAGE_FOR_CLEAR[std::min(__builtin_popcount(game.getLastClearedRows()), 4)];
+			}
+			locked[player] = (game.getPiecesPlaced() != pieces);
+		}
+
+		for (int player = 0; player < players; player++) {
+			int cancelled = std::min(attack[player], pending_garbage[player]);
+			pending_garbage[player] -= cancelled;
+			attack[player] -= cancelled;
+		}
+		for (int player = 0; player < players; player++) {
+			int target = nextAlive(player);
+			if ((attack[player] > 0) and (target != player)) {
+				pending_garbage[target] += attack[player];
+				garbage_sent[player] += attack[player];
+			}
+		}
+		for (int player = 0; player < players; player++) {
+			if (locked[player] and (pending_garbage[player] > 0) and !games[player].isGameOver()) {
+				games[player].addGarbage(pending_garbage[player], garbage_random.nextBelow(BOARD_WIDTH));
+				garbage_received[player] += pending_garbage[player];
+				pending_garbage[player] = 0;
+			}
+		}
+		tick++;
+	}
+
+	bool isOver() const {
+		/* Over when one player is left, or for a match of one, when its game is over */
+		int alive = 0;
+		for (int player = 0; player < players; player++) {
+			alive += games[player].isGameOver() ? 0 : 1;
+		}
+		return (players == 1) ? (alive == 0) : (alive <= 1);
+	}
+
+	int winner() const {
+		/* The player left when the match is over, or -1 if there is none (yet) */
+		if ((players == 1) or !isOver()) {
+			return -1;
+		}
+		for (int player = 0; player < players; player++) {
+			if (!games[player].isGameOver()) {
+				return player;
+			}
+		}
+		return -1;
+	}
+
+	uint64_t checksum() const {
+		/* Every board's checksum and the garbage state, folded together with FNV-1a */
+		uint64_t hash = 14695981039346656037ULL;
+		auto mix = [&hash](uint64_t value) {
+			for (int i = 0; i < 8; i++) {
+				hash = (hash ^ ((value >> (8 * i)) & 0xFF)) * 1099511628211ULL;
+			}
+		};
+		mix(tick);
+		mix(garbage_random.getState());
+		for (int player = 0; player < players; player++) {
+			mix(games[player].checksum());
+			mix((uint64_t)(uint32_t)pending_garbage[player] | ((uint64_t)(uint32_t)garbage_sent[player] << 32));
+		}
+		return hash;
+	}
+
+	int getPlayers() const {
+		return players;
+	}
+
+	const Game& getGame(int player) const {
+		return games[player];
+	}
+
+	uint32_t getTick() const {
+		return tick;
+	}
+
+	int getPendingGarbage(int player) const {
+		return pending_garbage[player];
+	}
+
+	int getGarbageSent(int player) const {
+		return garbage_sent[player];
+	}
+
+	int getGarbageReceived(int player) const {
+		return garbage_received[player];
+	}
+};
+
+// Ticks a session can run ahead of the inputs it has, and the snapshots it keeps to roll back over them
+const int MAX_ROLLBACK_TICKS = 32;
+
+// A confirmed tick's checksum is kept once every this many ticks, for peers to compare
+const uint32_t CHECKSUM_INTERVAL = 16;
+
+struct VersusChecksum {
+	uint32_t tick;		// The state before this tick, with every input up to it confirmed
+	uint64_t checksum;
+};
+
+class RollbackSession {
+private:
+	// Inputs are kept for twice the rollback window, as other players can be a whole window ahead of this one
+	static const int INPUT_RING = 2 * MAX_ROLLBACK_TICKS;
+
+	struct InputSlot {
+		uint32_t tick = UINT32_MAX;
+		VersusInput input = 0;
+	};
+
+	VersusMatch match;
+	VersusMatch snapshots[MAX_ROLLBACK_TICKS];	// The state before tick t is at t % MAX_ROLLBACK_TICKS
+	InputSlot inputs[MAX_VERSUS_PLAYERS][INPUT_RING];
+
+	// Every player's inputs are known for the ticks before received[player]
+	uint32_t received[MAX_VERSUS_PLAYERS] = {};
+
+	// Earliest simulated tick that was run with a wrong prediction, UINT32_MAX if none
+	uint32_t rollback_tick = UINT32_MAX;
+
+	// Latest tick whose state is confirmed, and whether the match was over there
+	uint32_t confirmed_tick = 0;
+	bool confirmed_over = false;
+	int confirmed_winner = -1;
+	std::vector<VersusChecksum> checksums;
+
+	uint64_t rollbacks = 0;
+	uint64_t resimulated_ticks = 0;
+	uint32_t deepest_rollback = 0;
+
+	VersusInput inputAt(int player, uint32_t tick) const {
+		/* The confirmed input, or the prediction of no input */
+		const InputSlot& slot = inputs[player][tick % INPUT_RING];
+		return (slot.tick == tick) ? slot.input : 0;
+	}
+
+	void simulate(uint32_t tick) {
+		VersusInput tick_inputs[MAX_VERSUS_PLAYERS];
+		for (int player = 0; player < match.getPlayers(); player++) {
+			tick_inputs[player] = inputAt(player, tick);
+		}
+		snapshots[tick % MAX_ROLLBACK_TICKS].copyFrom(match);
+		match.step(tick_inputs);
+	}
+
+	void resimulate() {
+		/* Go back to the earliest tick a wrong prediction was used for and simulate again up to where the match was */
+		uint32_t frame = match.getTick();
+		if (rollback_tick < frame) {
+			match.copyFrom(snapshots[rollback_tick % MAX_ROLLBACK_TICKS]);
+			for (uint32_t tick = rollback_tick; tick < frame; tick++) {
+				simulate(tick);
+			}
+			rollbacks++;
+			resimulated_ticks += frame - rollback_tick;
+			deepest_rollback = std::max(deepest_rollback, frame - rollback_tick);
+		}
+		rollback_tick = UINT32_MAX;
+	}
+
+	const VersusMatch& stateBefore(uint32_t tick) const {
+		return (tick == match.getTick()) ? match : snapshots[tick % MAX_ROLLBACK_TICKS];
+	}
+
+public:
+	RollbackSession(int players = 2, uint64_t seed = 0) : match(players, seed) {}
+
+	bool setInput(int player, uint32_t tick, VersusInput input) {
+		/* Record a player's input for a tick, local or from a peer. Returns false if the tick is already confirmed
+		   or too far ahead to hold, which a peer keeping to the protocol never sends.
+		*/
+		if ((player < 0) or (player >= match.getPlayers()) or (tick < received[player]) or (tick >= received[player] + INPUT_RING)) {
+			return false;
+		}
+		InputSlot& slot = inputs[player][tick % INPUT_RING];
+		if (slot.tick == tick) {
+			return slot.input == input;
+		}
+		slot.tick = tick;
+		slot.input = input;
+		if ((tick < match.getTick()) and (input != 0)) {
+			rollback_tick = std::min(rollback_tick, tick);
+		}
+		while (inputs[player][received[player] % INPUT_RING].tick == received[player]) {
+			received[player]++;
+		}
+		return true;
+	}
+
+	uint32_t getConfirmedInputs() const {
+		/* Ticks before this have every player's input */
+		uint32_t confirmed = UINT32_MAX;
+		for (int player = 0; player < match.getPlayers(); player++) {
+			confirmed = std::min(confirmed, received[player]);
+		}
+		return confirmed;
+	}
+
+	uint32_t getReceived(int player) const {
+		return received[player];
+	}
+
+	bool canAdvance() const {
+		return match.getTick() < getConfirmedInputs() + MAX_ROLLBACK_TICKS;
+	}
+
+	void advance() {
+		/* Simulate the next tick, after rolling back and resimulating if a prediction turned out wrong. The caller
+		   sets the local player's input for that tick first.
+		*/
+		PROFILE_SCOPE("rollbackAdvance");
+		resimulate();
+		simulate(match.getTick());
+		confirm();
+	}
+
+	void confirm() {
+		/* Move the confirmed tick up to the last tick with every input known. advance() does this, and it is also
+		   called when inputs arrive for a session that isn't advancing, such as one that has stopped at a tick limit.
+		*/
+		resimulate();
+		// States with every input before them known never change again
+		uint32_t confirmed = std::min(getConfirmedInputs(), match.getTick());
+		while (!confirmed_over and (confirmed_tick < confirmed)) {
+			confirmed_tick++;
+			const VersusMatch& state = stateBefore(confirmed_tick);
+			if (state.isOver()) {
+				confirmed_over = true;
+				confirmed_winner = state.winner();
+			}
+			if (confirmed_over or (confirmed_tick % CHECKSUM_INTERVAL == 0)) {
+				checksums.push_back(VersusChecksum{ confirmed_tick, state.checksum() });
+			}
+		}
+	}
+
+	const VersusMatch& getMatch() const {
+		/* The latest state, which rests on predictions for inputs that haven't arrived */
+		return match;
+	}
+
+	uint32_t getTick() const {
+		return match.getTick();
+	}
+
+	// Whether the match is over in a confirmed state, which every peer agrees on, and who won
+	bool isConfirmedOver() const {
+		return confirmed_over;
+	}
+
+	int getWinner() const {
+		return confirmed_winner;
+	}
+
+	uint32_t getConfirmedTick() const {
+		return confirmed_tick;
+	}
+
+	const VersusMatch& getConfirmedMatch() const {
+		return stateBefore(confirmed_tick);
+	}
+
+	std::vector<VersusChecksum> takeChecksums() {
+		/* Checksums of the confirmed states since the last call, the last one at the end of the match */
+		std::vector<VersusChecksum> taken;
+		taken.swap(checksums);
+		return taken;
+	}
+
+	uint64_t getRollbacks() const {
+		return rollbacks;
+	}
+
+	uint64_t getResimulatedTicks() const {
+		return resimulated_ticks;
+	}
+
+	uint32_t getDeepestRollback() const {
+		return deepest_rollback;
+	}
+};